@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ASSET_MANAGER_FILE_SYSTEM is mockfs for the whole target, see CMakeLists.txt
+#include "mock_filesystem.h"
+#include "devkit/util.h"
+#include "devkit/asset_manager.h"
+
+// Times AssetManager operations on in-memory trees. Prints one JSON object per measurement:
+// devkit_bench [--files 10000,100000,1000000] [--depth 2,6] [--mix all,sparse] [--mode blocking,background,pack] [--repeat 5]
+//
+// blocking:   synchronize walks the tree on the calling thread
+// background: synchronize scans on workers, measured until the change set is applied, *_calls is the time spent
+//             inside synchronize calls meanwhile
+// pack:       the tree is packed into a temporary file and mounted, packs never change so there are no edits
+
+using namespace NS_DEVKIT;
+
+namespace {
+
+struct Texture  { uint32_t id; void reload(const wchar_t*) { ++id; } };
+struct Mesh		{ uint32_t id; };
+struct Material { uint32_t id; };
+
+struct Case {
+	size_t		files;
+	size_t		depth;
+	std::string mix; // all: every file has a handler, sparse: one in four has
+	std::string mode;
+};
+
+constexpr size_t c_filesPerDirectory = 64;
+const std::wstring c_root = L"bench";
+
+// Spread files over leaf directories depth levels below the root
+std::vector<std::wstring> buildTree(const Case& c) {
+	static const wchar_t* allExtensions[] = { L".tex", L".mesh", L".mat" };
+	static const wchar_t* sparseExtensions[] = { L".tex", L".bin", L".bin", L".bin" };
+
+	mockfs::clear();
+	mockfs::createDirectory(c_root);
+
+	size_t leafCount = (c.files + c_filesPerDirectory - 1) / c_filesPerDirectory;
+	size_t fanout = std::max<size_t>(2, (size_t)std::ceil(std::pow((double)leafCount, 1.0 / std::max<size_t>(c.depth, 1))));
+
+	std::vector<std::wstring> paths;
+	paths.reserve(c.files);
+	for (size_t i = 0; i < c.files; ++i) {
+		size_t leaf = i / c_filesPerDirectory;
+		mockfs::path directory = c_root;
+		for (size_t level = 0; level < c.depth; ++level) {
+			directory /= L"d" + std::to_wstring(leaf % fanout);
+			leaf /= fanout;
+		}
+
+		const wchar_t* extension = c.mix == "sparse" ? sparseExtensions[i % 4] : allExtensions[i % 3];
+		mockfs::path file = directory / (L"f" + std::to_wstring(i) + extension);
+		mockfs::createFile(file, 1024);
+		paths.push_back(file.wstring());
+	}
+	return paths;
+}
+
+// Pack of the mock tree written straight from its nodes, entries are empty as handlers never read the files
+std::filesystem::path writePack(const std::vector<std::wstring>& files) {
+	using Pack = AssetManager::Pack;
+
+	std::vector<std::pair<std::string, Pack::Entry>> entries;
+	entries.reserve(files.size());
+	for (const auto& file : files) {
+		std::u8string relative = mockfs::path(file).lexically_relative(c_root).generic_u8string();
+		Pack::Entry entry{};
+		entry.offset = sizeof(Pack::Header);
+		entry.writeTime = mockfs::last_write_time(file).time_since_epoch().count();
+		entries.push_back({ std::string(relative.begin(), relative.end()), entry });
+	}
+	std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::string strings;
+	for (auto& [relative, entry] : entries) {
+		entry.pathOffset = (uint32_t)strings.size();
+		entry.pathSize = (uint32_t)relative.size();
+		strings += relative;
+	}
+
+	Pack::Header header;
+	header.entryCount = entries.size();
+	header.indexOffset = sizeof(Pack::Header);
+	header.stringsOffset = header.indexOffset + entries.size() * sizeof(Pack::Entry);
+	header.stringsSize = strings.size();
+
+	std::filesystem::path pack = std::filesystem::temp_directory_path() / "devkit_bench.pack";
+	std::ofstream out(pack, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const auto& [relative, entry] : entries)
+		out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	out.write(strings.data(), (std::streamsize)strings.size());
+	if (!out)
+		throw std::runtime_error("Failed to write " + pack.string());
+	return pack;
+}
+
+template <typename F>
+double seconds(F&& function) {
+	auto start = std::chrono::steady_clock::now();
+	function();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Results {
+	std::vector<std::pair<std::string, std::vector<double>>> samples{};
+	std::vector<std::pair<std::string, size_t>>				 items{};
+
+	void add(const std::string& name, double time, size_t itemCount) {
+		auto it = std::find_if(samples.begin(), samples.end(), [&](const auto& s) { return s.first == name; });
+		if (it == samples.end()) {
+			samples.push_back({ name, {} });
+			items.push_back({ name, itemCount });
+			it = samples.end() - 1;
+		}
+		it->second.push_back(time);
+	}
+
+	void print(const Case& c) {
+		for (size_t i = 0; i < samples.size(); ++i) {
+			auto times = samples[i].second;
+			std::sort(times.begin(), times.end());
+			double median = times[times.size() / 2];
+			nlohmann::json line = {
+				{ "benchmark", samples[i].first },
+				{ "files", c.files },
+				{ "depth", c.depth },
+				{ "mix", c.mix },
+				{ "mode", c.mode },
+				{ "items", items[i].second },
+				{ "repeat", times.size() },
+				{ "seconds", median },
+				{ "min_seconds", times.front() },
+				{ "ns_per_item", items[i].second ? median * 1e9 / items[i].second : 0.0 },
+			};
+			std::cout << line.dump() << std::endl;
+		}
+	}
+};
+
+void run(const Case& c, size_t repeat) {
+	std::vector<std::wstring> files = buildTree(c);
+	std::vector<std::wstring> handled;
+	for (const auto& file : files)
+		if (!file.ends_with(L".bin"))
+			handled.push_back(file);
+
+	std::filesystem::path pack = c.mode == "pack" ? writePack(files) : std::filesystem::path();
+
+	std::mt19937 random(1234);
+	Results results;
+	for (size_t r = 0; r < repeat; ++r) {
+		AssetManager am;
+		auto open = [&](auto&&... extensions) -> auto& {
+			if (c.mode == "pack")
+				return am.mount(std::wstring(c_root), pack.wstring().c_str(), std::move(extensions)...);
+			return am.directory(std::wstring(c_root), std::move(extensions)...);
+		};
+		auto& dir = open(
+			am.ext(L".tex", [](const wchar_t*) { return Texture{ 1 }; }),
+			am.ext(L".tex", &Texture::reload),
+			am.ext(L".mesh", [](const wchar_t*) { return Mesh{ 1 }; }),
+			am.ext(L".mat", [](const wchar_t*) { return Material{ 1 }; }));
+
+		// Background synchronizes are polled like a frame loop would until the scan's changes are applied
+		auto synchronize = [&](const std::string& name) {
+			if (c.mode != "background") {
+				results.add(name, seconds([&] { dir.synchronize(); }), files.size());
+				return;
+			}
+			double calls = 0;
+			results.add(name, seconds([&] {
+				do {
+					calls += seconds([&] { dir.synchronize(AssetManager::SyncMode::Background); });
+					if (dir.synchronizing())
+						std::this_thread::sleep_for(std::chrono::microseconds(100));
+				} while (dir.synchronizing());
+			}), files.size());
+			results.add(name + "_calls", calls, files.size());
+		};
+
+		synchronize("first_sync");
+		synchronize("noop_resync");
+
+		// 1% edits
+		std::vector<std::wstring> sample;
+		if (c.mode != "pack") {
+			std::sample(handled.begin(), handled.end(), std::back_inserter(sample), std::max<size_t>(1, handled.size() / 100), random);
+			for (const auto& file : sample)
+				mockfs::touch(file);
+			synchronize("edit_1pct_resync");
+		}
+
+		// Lookups in random order
+		std::vector<std::wstring> lookups = handled;
+		std::shuffle(lookups.begin(), lookups.end(), random);
+		uint64_t sum = 0;
+		results.add("get_exp", seconds([&] {
+			for (const auto& file : lookups) {
+				if (file.ends_with(L".tex"))
+					sum += dir.get_exp<Texture>(file.c_str())->get().id;
+				else if (file.ends_with(L".mesh"))
+					sum += dir.get_exp<Mesh>(file.c_str())->get().id;
+				else
+					sum += dir.get_exp<Material>(file.c_str())->get().id;
+			}
+		}), lookups.size());
+
+		std::vector<AssetManager::AssetHandle<Texture>> handles;
+		for (const auto& file : lookups)
+			if (auto handle = dir.handle<Texture>(file.c_str()))
+				handles.push_back(*handle);
+		results.add("get_handle", seconds([&] {
+			for (const auto& handle : handles)
+				sum += dir.get_exp(handle)->get().id;
+		}), handles.size());
+
+		results.add("get_all", seconds([&] {
+			for (auto [path, texture] : dir.getAll<Texture>())
+				sum += texture.id;
+		}), handles.size());
+
+		// 1% deletions, restored for the next repetition
+		if (c.mode != "pack") {
+			sample.clear();
+			std::sample(files.begin(), files.end(), std::back_inserter(sample), std::max<size_t>(1, files.size() / 100), random);
+			for (const auto& file : sample)
+				mockfs::remove(file);
+			synchronize("delete_1pct_resync");
+			for (const auto& file : sample)
+				mockfs::createFile(file, 1024);
+		}
+
+		// Keeps the lookups from being optimized out
+		if (sum == 0)
+			std::fputs("", stderr);
+	}
+	results.print(c);
+
+	if (!pack.empty())
+		std::filesystem::remove(pack);
+}
+
+template <typename T, typename F>
+std::vector<T> parseList(const std::string& list, F&& parse) {
+	std::vector<T> values;
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = std::min(list.find(',', start), list.size());
+		values.push_back(parse(list.substr(start, end - start)));
+		start = end + 1;
+	}
+	return values;
+}
+
+}
+
+int main(int argc, char** argv) {
+	std::vector<size_t> files = { 10'000, 100'000, 1'000'000 };
+	std::vector<size_t> depths = { 2, 6 };
+	std::vector<std::string> mixes = { "all", "sparse" };
+	std::vector<std::string> modes = { "blocking", "background", "pack" };
+	size_t repeat = 5;
+
+	auto toSize = [](const std::string& s) { return (size_t)std::stoull(s); };
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i], value = argv[i + 1];
+		if (option == "--files")
+			files = parseList<size_t>(value, toSize);
+		else if (option == "--depth")
+			depths = parseList<size_t>(value, toSize);
+		else if (option == "--mix")
+			mixes = parseList<std::string>(value, [](const std::string& s) { return s; });
+		else if (option == "--mode")
+			modes = parseList<std::string>(value, [](const std::string& s) { return s; });
+		else if (option == "--repeat")
+			repeat = std::max<size_t>(1, toSize(value));
+		else {
+			std::cerr << "Unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	for (const auto& mode : modes) {
+		if (mode != "blocking" && mode != "background" && mode != "pack") {
+			std::cerr << "Unknown mode " << mode << std::endl;
+			return 1;
+		}
+	}
+
+	for (size_t fileCount : files)
+		for (size_t depth : depths)
+			for (const auto& mix : mixes)
+				for (const auto& mode : modes)
+					run({ fileCount, depth, mix, mode }, repeat);
+	return 0;
+}
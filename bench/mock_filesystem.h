@@ -0,0 +1,317 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+// In-memory stand-in for the parts of std::filesystem the asset manager uses.
+// Plugged in through ASSET_MANAGER_FILE_SYSTEM, paths are plain std::filesystem::path values.
+namespace mockfs {
+
+using path = std::filesystem::path;
+using file_time_type = std::filesystem::file_time_type;
+
+struct Node {
+	bool				  directory = false;
+	file_time_type		  writeTime{};
+	uintmax_t			  size = 0;
+	std::string			  contents{}; // Only kept for written files, others read as size zero bytes
+	std::set<std::wstring> children{}; // Full paths
+};
+
+struct Tree {
+	std::unordered_map<std::wstring, Node> nodes{};
+	file_time_type						   epoch = file_time_type::clock::now() - std::chrono::hours(1);
+	file_time_type::rep					   clock = 0;
+
+	// Distinct write time for every modification, in the past like the times of files not written right now
+	file_time_type tick() { return epoch + file_time_type::duration(++clock); }
+};
+
+inline Tree& tree() {
+	static Tree instance;
+	return instance;
+}
+
+inline Node* find(const path& p) {
+	auto it = tree().nodes.find(p.wstring());
+	return it != tree().nodes.end() ? &it->second : nullptr;
+}
+
+// Creates missing parent directories
+inline void createDirectory(const path& p) {
+	auto [it, inserted] = tree().nodes.try_emplace(p.wstring());
+	if (!inserted)
+		return;
+	it->second.directory = true;
+	it->second.writeTime = tree().tick();
+	if (p.has_parent_path() && p.parent_path() != p) {
+		createDirectory(p.parent_path());
+		Node& parent = tree().nodes[p.parent_path().wstring()];
+		parent.children.insert(p.wstring());
+		parent.writeTime = tree().tick();
+	}
+}
+
+inline void createFile(const path& p, uintmax_t size = 0) {
+	createDirectory(p.parent_path());
+	Node& node = tree().nodes[p.wstring()];
+	node.size = size;
+	node.contents.clear();
+	node.writeTime = tree().tick();
+	Node& parent = tree().nodes[p.parent_path().wstring()];
+	if (parent.children.insert(p.wstring()).second)
+		parent.writeTime = tree().tick();
+}
+
+inline void write(const path& p, std::string contents) {
+	createFile(p, contents.size());
+	tree().nodes[p.wstring()].contents = std::move(contents);
+}
+
+inline void touch(const path& p) {
+	if (Node* node = find(p))
+		node->writeTime = tree().tick();
+}
+
+inline void remove(const path& p) {
+	Node* node = find(p);
+	if (!node)
+		return;
+	for (const auto& child : std::set<std::wstring>(node->children))
+		mockfs::remove(child);
+	if (Node* parent = find(p.parent_path())) {
+		parent->children.erase(p.wstring());
+		parent->writeTime = tree().tick();
+	}
+	tree().nodes.erase(p.wstring());
+}
+
+inline void clear() {
+	tree() = {};
+}
+
+inline bool exists(const path& p) { return mockfs::find(p) != nullptr; }
+
+inline bool is_directory(const path& p) {
+	Node* node = find(p);
+	return node && node->directory;
+}
+
+inline bool is_regular_file(const path& p) {
+	Node* node = find(p);
+	return node && !node->directory;
+}
+
+// Like std::filesystem, a missing path is reported through error
+inline bool is_directory(const path& p, std::error_code& error) {
+	error.clear();
+	if (!find(p))
+		error = std::make_error_code(std::errc::no_such_file_or_directory);
+	return mockfs::is_directory(p);
+}
+
+inline bool is_regular_file(const path& p, std::error_code& error) {
+	error.clear();
+	if (!find(p))
+		error = std::make_error_code(std::errc::no_such_file_or_directory);
+	return mockfs::is_regular_file(p);
+}
+
+inline file_time_type last_write_time(const path& p, std::error_code& error) {
+	error.clear();
+	if (Node* node = find(p))
+		return node->writeTime;
+	error = std::make_error_code(std::errc::no_such_file_or_directory);
+	return file_time_type::min();
+}
+
+inline file_time_type last_write_time(const path& p) {
+	std::error_code error;
+	file_time_type writeTime = mockfs::last_write_time(p, error);
+	if (error)
+		throw std::filesystem::filesystem_error("last_write_time", p, error);
+	return writeTime;
+}
+
+inline uintmax_t file_size(const path& p, std::error_code& error) {
+	error.clear();
+	Node* node = find(p);
+	if (node && !node->directory)
+		return node->size;
+	error = std::make_error_code(std::errc::no_such_file_or_directory);
+	return static_cast<uintmax_t>(-1);
+}
+
+// Files only, replaces an existing destination and keeps the write time like a real rename
+inline void rename(const path& from, const path& to, std::error_code& error) {
+	Node* node = find(from);
+	if (!node || node->directory) {
+		error = std::make_error_code(std::errc::no_such_file_or_directory);
+		return;
+	}
+	error.clear();
+	Node moved = std::move(*node);
+	mockfs::remove(from);
+	mockfs::remove(to);
+	createFile(to, moved.size);
+	Node& target = tree().nodes[to.wstring()];
+	target.contents = std::move(moved.contents);
+	target.writeTime = moved.writeTime;
+}
+
+// Streams over file contents, an ofstream writes its file when destroyed.
+// Reading from several threads is fine as long as nothing writes meanwhile.
+class ifstream : public std::istringstream {
+public:
+	explicit ifstream(const path& p, std::ios::openmode mode = std::ios::in)
+		: std::istringstream(std::ios::in | mode)
+	{
+		Node* node = find(p);
+		if (!node || node->directory) {
+			setstate(std::ios::failbit);
+			return;
+		}
+		str(node->contents.size() == node->size ? node->contents : std::string(node->size, '\0'));
+	}
+};
+
+class ofstream : public std::ostringstream {
+public:
+	explicit ofstream(const path& p, std::ios::openmode mode = std::ios::out)
+		: std::ostringstream(std::ios::out | mode)
+		, m_path(p)
+	{
+		if (p.has_parent_path() && !mockfs::is_directory(p.parent_path()))
+			setstate(std::ios::failbit);
+	}
+	~ofstream() {
+		if (!fail())
+			mockfs::write(m_path, str());
+	}
+private:
+	mockfs::path m_path;
+};
+
+class directory_entry {
+public:
+	directory_entry() = default;
+	directory_entry(mockfs::path p) : m_path(std::move(p)) { }
+
+	const mockfs::path& path() const { return m_path; }
+	bool is_directory() const { return mockfs::is_directory(m_path); }
+	bool is_regular_file() const { return mockfs::is_regular_file(m_path); }
+	bool is_regular_file(std::error_code& error) const { return mockfs::is_regular_file(m_path, error); }
+private:
+	mockfs::path m_path;
+};
+
+// Both iterators walk the child sets directly, the tree must not change while iterating
+class directory_iterator {
+public:
+	directory_iterator() = default;
+	explicit directory_iterator(const path& p) {
+		Node* node = find(p);
+		if (!node || !node->directory || node->children.empty())
+			return;
+		m_state = std::make_shared<State>(State{ node->children.begin(), node->children.end() });
+		m_state->entry = directory_entry(*m_state->it);
+	}
+
+	const directory_entry& operator*() const { return m_state->entry; }
+	const directory_entry* operator->() const { return &m_state->entry; }
+
+	directory_iterator& operator++() {
+		if (++m_state->it == m_state->end)
+			m_state = nullptr;
+		else
+			m_state->entry = directory_entry(*m_state->it);
+		return *this;
+	}
+
+	bool operator==(const directory_iterator& other) const { return m_state == other.m_state; }
+	bool operator!=(const directory_iterator& other) const { return m_state != other.m_state; }
+private:
+	struct State {
+		std::set<std::wstring>::const_iterator it, end;
+		directory_entry						   entry{};
+	};
+	std::shared_ptr<State> m_state{};
+};
+
+inline directory_iterator begin(directory_iterator it) { return it; }
+inline directory_iterator end(const directory_iterator&) { return {}; }
+
+class recursive_directory_iterator {
+public:
+	recursive_directory_iterator() = default;
+	explicit recursive_directory_iterator(const path& p) {
+		Node* node = find(p);
+		if (!node || !node->directory)
+			return;
+		m_state = std::make_shared<State>();
+		push(*node);
+		settle();
+	}
+
+	recursive_directory_iterator(const path& p, std::error_code& error) 
+		: recursive_directory_iterator(p) 
+	{
+		error.clear();
+		if (!find(p))
+			error = std::make_error_code(std::errc::no_such_file_or_directory);
+	}
+
+	const directory_entry& operator*() const { return m_state->entry; }
+	const directory_entry* operator->() const { return &m_state->entry; }
+
+	recursive_directory_iterator& increment(std::error_code& error) {
+		error.clear();
+		return ++*this;
+	}
+
+	recursive_directory_iterator& operator++() {
+		// Descend into the current entry before moving past it
+		auto& top = m_state->stack.back();
+		Node& current = tree().nodes.at(*top.first++);
+		if (current.directory)
+			push(current);
+		settle();
+		return *this;
+	}
+
+	bool operator==(const recursive_directory_iterator& other) const { return m_state == other.m_state; }
+	bool operator!=(const recursive_directory_iterator& other) const { return m_state != other.m_state; }
+private:
+	using Range = std::pair<std::set<std::wstring>::const_iterator, std::set<std::wstring>::const_iterator>;
+	struct State {
+		std::vector<Range> stack{};
+		directory_entry	   entry{};
+	};
+	std::shared_ptr<State> m_state{};
+
+	void push(const Node& node) {
+		m_state->stack.emplace_back(node.children.begin(), node.children.end());
+	}
+
+	// Pop exhausted directories, end once the root is
+	void settle() {
+		auto& stack = m_state->stack;
+		while (!stack.empty() && stack.back().first == stack.back().second)
+			stack.pop_back();
+		if (stack.empty())
+			m_state = nullptr;
+		else
+			m_state->entry = directory_entry(*stack.back().first);
+	}
+};
+
+inline recursive_directory_iterator begin(recursive_directory_iterator it) { return it; }
+inline recursive_directory_iterator end(const recursive_directory_iterator&) { return {}; }
+
+}
@@ -1,15 +1,45 @@
 #pragma once
 #include <functional>
+#include <memory>
 #include <any>
+#include <new>
+#include <cstddef>
+#include <cstdint>
 #include <future>
+#include <chrono>
 #include <optional>
 #include <expected>
 #include <filesystem>
+#include <fstream>
+#include <typeinfo>
 #include <semaphore>
-
-// Enable mocking of filesystem
+#include <atomic>
+#include <queue>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <algorithm>
+
+// Enable mocking of filesystem. Besides the std::filesystem subset, a mock provides the ifstream, ofstream
+// and rename used for content hashes, manifests and access profiles. Every translation unit of a program must
+// see the same file system, builds defining it for all of them name the header declaring the mock in
+// ASSET_MANAGER_FILE_SYSTEM_INCLUDE.
+#ifdef ASSET_MANAGER_FILE_SYSTEM_INCLUDE
+#include ASSET_MANAGER_FILE_SYSTEM_INCLUDE
+#endif
 #ifndef ASSET_MANAGER_FILE_SYSTEM
 #define ASSET_MANAGER_FILE_SYSTEM std::filesystem
+#define ASSET_MANAGER_NATIVE_FILE_SYSTEM
 #endif
 namespace AssetManager_filesystem = ASSET_MANAGER_FILE_SYSTEM;
 
@@ -41,7 +71,438 @@ class AssetManager {
 public:
 	enum class Execution { Sync = 0x0, Async = 0x1, Deferred = 0x2 };
 
-	enum class AssetReturnStatus { Ok = 0x00, NotFound, TypeMismatch };
+	// Failed: the handler threw, the asset has no value until its file changes and it reloads
+	enum class AssetReturnStatus { Ok = 0x00, NotFound, TypeMismatch, Pending, Failed };
+
+	// Blocking: walk the directory on the calling thread
+	// Background: walk on worker threads, apply the resulting change set on a later call
+	enum class SyncMode { Blocking = 0x0, Background = 0x1 };
+
+	// Worker queue of Async handlers, I/O bound loads don't wait behind CPU bound ones
+	enum class LoadQueue { Io = 0x0, Decode = 0x1 };
+
+	struct LoadOptions {
+		int		  priority = 0; // Higher runs first, equal priorities in submission order
+		LoadQueue queue    = LoadQueue::Decode;
+
+		// For init handlers: reloads build a new instance instead of calling the update handler in place.
+		// Readers keep the previous version until the next synchronize publishes the new one, see Directory::pin.
+		bool	  versioned = false;
+
+		// For init handlers: a changed file reloads only once its write time held for this long, see Directory::settleWindow
+		std::chrono::milliseconds settleWindow{ 0 };
+	};
+
+	// Two phase handler, see AssetManager::staged
+	template <typename Decode, typename Upload>
+	struct Staged {
+		Decode decode;
+		Upload upload;
+	};
+
+	// Per call limits of AssetManager::upload
+	struct UploadBudget {
+		std::chrono::nanoseconds time  = std::chrono::nanoseconds::max();
+		size_t				 bytes = SIZE_MAX;
+	};
+
+private:
+	// Handler call queued on a LoadScheduler. Whoever claims it first either runs or cancels it.
+	struct LoadTask {
+		std::function<void()> work;
+		LoadQueue			  queue;
+		std::promise<void>	  promise{};
+		std::atomic<bool>	  claimed = false;
+
+		bool cancel() {
+			if (claimed.exchange(true))
+				return false; // Already running or done
+			promise.set_value();
+			return true;
+		}
+	};
+
+	// Upload phase of a staged load, queued for AssetManager::upload. Whoever claims it first either runs or skips it.
+	struct UploadTask {
+		std::function<void()>				work{};
+		size_t								bytes = 0; // Decoded size, counted against UploadBudget::bytes
+		std::atomic<bool>					claimed = false;
+		std::atomic<bool>					finished = false;
+		const std::atomic<std::thread::id>* uploadThread = nullptr; // Set once queued, only that thread runs it
+
+		bool run() {
+			if (claimed.exchange(true))
+				return false;
+			try {
+				if (work)
+					work();
+			}
+			catch (...) { } // Failed uploads leave the asset as a failed load would
+			finish();
+			return true;
+		}
+
+		bool skip() {
+			if (claimed.exchange(true))
+				return false;
+			finish();
+			return true;
+		}
+
+		void wait() const {
+			finished.wait(false);
+		}
+
+		// Wait for the upload, running it if this is the upload thread. Uploads never queued already ran or were skipped.
+		void resolve() {
+			if (uploadThread && uploadThread->load(std::memory_order_relaxed) == std::this_thread::get_id() && run())
+				return;
+			wait();
+		}
+
+	private:
+		void finish() {
+			work = nullptr; // Drops the decoded data
+			finished = true;
+			finished.notify_all();
+		}
+	};
+
+	struct UploadQueue {
+		std::mutex								mut{};
+		std::deque<std::shared_ptr<UploadTask>> tasks{};
+		std::atomic<std::thread::id>			thread{ std::this_thread::get_id() }; // Last to call upload, or the creator
+
+		bool onUploadThread() const {
+			return thread.load(std::memory_order_relaxed) == std::this_thread::get_id();
+		}
+
+		void push(std::shared_ptr<UploadTask> task) {
+			task->uploadThread = &thread;
+			std::lock_guard lock(mut);
+			tasks.push_back(std::move(task));
+		}
+	};
+
+public:
+	// Fixed pool of workers for Execution::Async handlers, started on first use
+	class LoadScheduler {
+	public:
+		struct Properties {
+			unsigned ioWorkers	   = 2;
+			unsigned decodeWorkers = 0; // 0: one less than hardware concurrency
+		};
+
+		LoadScheduler()
+			: LoadScheduler(Properties{})
+		{ }
+
+		LoadScheduler(Properties properties)
+			: m_properties(properties)
+		{ 
+			if (m_properties.decodeWorkers == 0)
+				m_properties.decodeWorkers = std::max(2u, std::thread::hardware_concurrency()) - 1; // hardware_concurrency may be 0
+		}
+
+		LoadScheduler(const LoadScheduler&) = delete;
+		LoadScheduler& operator=(const LoadScheduler&) = delete;
+
+		std::shared_ptr<LoadTask> submit(std::function<void()>&& work, LoadOptions options) {
+			auto task = std::make_shared<LoadTask>(std::move(work), options.queue);
+			std::lock_guard lock(m_mut);
+			start();
+			push(task, options.priority);
+			return task;
+		}
+
+		// Queue task again with a new priority. The entry claimed first wins, the other one is skipped.
+		bool reprioritize(const std::shared_ptr<LoadTask>& task, int priority) {
+			if (task->claimed)
+				return false;
+			std::lock_guard lock(m_mut);
+			push(task, priority);
+			return true;
+		}
+
+		~LoadScheduler() {
+			{
+				std::lock_guard lock(m_mut);
+				m_stop = true;
+			}
+			for (auto& queue : m_queues)
+				queue.cv.notify_all();
+			for (auto& worker : m_workers)
+				worker.join();
+		}
+
+	private:
+		struct Entry {
+			int						  priority;
+			uint64_t				  sequence;
+			std::shared_ptr<LoadTask> task;
+
+			bool operator<(const Entry& other) const {
+				if (priority != other.priority)
+					return priority < other.priority;
+				return sequence > other.sequence;
+			}
+		};
+
+		struct Queue {
+			std::priority_queue<Entry> entries{};
+			std::condition_variable	   cv{};
+		};
+
+		Properties				 m_properties;
+		std::mutex				 m_mut{};
+		std::array<Queue, 2>	 m_queues{};
+		std::vector<std::thread> m_workers{};
+		uint64_t				 m_sequence = 0;
+		bool					 m_stop		= false;
+
+		void start() {
+			if (!m_workers.empty())
+				return;
+			for (unsigned i = 0; i < m_properties.ioWorkers; ++i)
+				m_workers.emplace_back(&LoadScheduler::work, this, LoadQueue::Io);
+			for (unsigned i = 0; i < m_properties.decodeWorkers; ++i)
+				m_workers.emplace_back(&LoadScheduler::work, this, LoadQueue::Decode);
+		}
+
+		void push(const std::shared_ptr<LoadTask>& task, int priority) {
+			auto& queue = m_queues[(size_t)task->queue];
+			queue.entries.push({ priority, m_sequence++, task });
+			queue.cv.notify_one();
+		}
+
+		void work(LoadQueue queueType) {
+			auto& queue = m_queues[(size_t)queueType];
+			while (true) {
+				std::shared_ptr<LoadTask> task;
+				{
+					std::unique_lock lock(m_mut);
+					queue.cv.wait(lock, [&] { return m_stop || !queue.entries.empty(); });
+					if (m_stop)
+						return;
+					task = queue.entries.top().task;
+					queue.entries.pop();
+				}
+
+				// Skip cancelled tasks and ones run through a reprioritized entry
+				if (task->claimed.exchange(true))
+					continue;
+
+				try { // Call handler and pass exceptions to future
+					task->work();
+					task->promise.set_value();
+				}
+				catch (...) {
+					task->promise.set_exception(std::current_exception());
+				}
+			}
+		}
+	};
+
+public:
+	// Kernel change notifications for a directory tree (inotify on Linux, ReadDirectoryChangesW on Windows)
+	class Watcher {
+	public:
+		// Returns nullptr if there is no backend for the platform or the tree can't be watched
+		static std::unique_ptr<Watcher> create(const std::wstring& path);
+
+		// Appends paths touched since the previous call. Directories are only reported when
+		// created, removed or moved. Returns false if events were lost and a full rescan is needed.
+		virtual bool poll(std::vector<std::wstring>& changed) = 0;
+
+		virtual ~Watcher() = default;
+	};
+
+	// Read-only view of a mapped file, passed to handlers taking one instead of a path.
+	// The manager maps the file before calling the handler and unmaps it once the handler returns.
+	class FileView {
+	public:
+		// Distinguishes files and their versions, write time ticks are platform specific
+		struct Identity {
+			uint64_t device = 0;
+			uint64_t file = 0;
+			uint64_t size = 0;
+			int64_t  writeTime = 0;
+
+			bool operator==(const Identity&) const = default;
+		};
+
+		// Returns nullptr if the file can't be opened or mapped
+		static std::unique_ptr<FileView> map(const wchar_t* path);
+
+		std::span<const std::byte> data() const { return m_data; }
+		std::string_view string() const { return { reinterpret_cast<const char*>(m_data.data()), m_data.size() }; }
+		const wchar_t* path() const { return m_path; }
+		const Identity& identity() const { return m_identity; }
+
+		FileView(const FileView&) = delete;
+		FileView& operator=(const FileView&) = delete;
+		virtual ~FileView() = default;
+
+	protected:
+		FileView(const wchar_t* path)
+			: m_path(path)
+		{ }
+
+		const wchar_t*			   m_path;
+		std::span<const std::byte> m_data{};
+		Identity				   m_identity{};
+	};
+
+	// Directory tree packed into a single file, written by Pack::write or the devkit_pack tool.
+	// Entries are sorted by their UTF-8 path relative to the packed directory with '/' separators,
+	// so lookups are a binary search over the mapped index. Entry data is aligned and optionally LZ4 compressed.
+	class Pack {
+	public:
+		static constexpr uint32_t c_magic = 0x4b504b44; // "DKPK"
+		static constexpr uint32_t c_version = 1;
+		static constexpr uint64_t c_alignment = 64;
+
+		struct Header {
+			uint32_t magic = c_magic;
+			uint32_t version = c_version;
+			uint64_t entryCount = 0;
+			uint64_t indexOffset = 0;
+			uint64_t stringsOffset = 0;
+			uint64_t stringsSize = 0;
+		};
+
+		enum Flags : uint32_t {
+			Compressed = 1 << 0,
+		};
+
+		struct Entry {
+			uint64_t offset = 0;
+			uint64_t size = 0;		   // Stored bytes
+			uint64_t originalSize = 0;
+			int64_t	 writeTime = 0;	   // file_time_type ticks of the packed file
+			uint32_t pathOffset = 0;   // Into the string table
+			uint32_t pathSize = 0;
+			uint32_t flags = 0;
+			uint32_t reserved = 0;
+		};
+
+		// Handlers see files of the pack below root, as if it was unpacked there.
+		// Returns nullptr if file can't be mapped or isn't a valid pack.
+		static std::unique_ptr<Pack> open(const wchar_t* file, std::wstring root);
+
+		// Pack every regular file below directory, compressing entries that shrink if compress is set
+		static bool write(const wchar_t* directory, const wchar_t* output, bool compress = false);
+
+		std::span<const Entry> entries() const { return m_entries; }
+		const std::wstring& root() const { return m_root; }
+
+		std::string_view path(const Entry& entry) const {
+			return m_strings.substr(entry.pathOffset, entry.pathSize);
+		}
+
+		const Entry* find(std::string_view path) const {
+			auto it = std::lower_bound(m_entries.begin(), m_entries.end(), path, 
+				[this](const Entry& entry, std::string_view path) { return this->path(entry) < path; });
+			return it != m_entries.end() && this->path(*it) == path ? &*it : nullptr;
+		}
+
+		// Contents of the file at path below root, decompressed if needed. Returns nullptr if it isn't packed.
+		std::unique_ptr<FileView> view(const wchar_t* path) const;
+
+	private:
+		Pack(std::unique_ptr<FileView> file, std::wstring root)
+			: m_file(std::move(file))
+			, m_root(std::move(root))
+		{ }
+
+		std::unique_ptr<FileView> m_file;
+		std::wstring			  m_root;
+		std::span<const Entry>	  m_entries{};
+		std::string_view		  m_strings{};
+	};
+
+	// Handler outputs on disk, one file per key. Entries are written to a temporary file and renamed into place,
+	// so processes sharing the directory only ever see complete ones. Hits refresh the entry's write time,
+	// and once the directory grows past maxBytes the least recently used entries are deleted.
+	class DerivedDataCache {
+	public:
+		struct Key {
+			uint64_t source = 0;  // Hash of the bytes the output is derived from
+			uint64_t version = 0; // Bumped whenever the handler's output changes
+			uint64_t options = 0; // Hash of the settings the output depends on
+		};
+
+		DerivedDataCache(std::wstring directory, uint64_t maxBytes);
+
+		// Returns nullptr on a miss
+		std::unique_ptr<FileView> load(const Key& key) const;
+
+		// Returns false if the entry couldn't be written, an entry stored by another process counts as written
+		bool store(const Key& key, std::span<const std::byte> data);
+
+		// Delete least recently used entries until the directory is well below maxBytes
+		void trim();
+
+		// Claim key for computing it, fails while another thread or process holds it. Release with unlock.
+		// Locks are held through an open lock file, so the OS releases them when their process dies.
+		bool lock(const Key& key);
+		void unlock(const Key& key);
+
+		// Wait for the holder of key's lock to store it. Returns nullptr if the lock is released without storing the entry.
+		std::unique_ptr<FileView> wait(const Key& key) const;
+
+		// FNV-1a, for building keys
+		static uint64_t hash(std::span<const std::byte> data) {
+			uint64_t hash = 0xcbf29ce484222325;
+			for (std::byte byte : data)
+				hash = (hash ^ (uint8_t)byte) * 0x100000001b3;
+			return hash;
+		}
+
+	private:
+		std::wstring path(const Key& key) const;
+
+		// True while any thread or process holds the lock file
+		static bool held(const std::wstring& lockFile);
+
+		std::wstring		  m_directory;
+		uint64_t			  m_maxBytes;
+		std::atomic<uint64_t> m_bytes = 0;		  // Estimate, recounted by trim
+		std::atomic<uint64_t> m_temporaryCount = 0;
+		uint64_t			  m_instance;		  // Keeps temporary names of processes apart
+		std::mutex			  m_trimMutex{};
+
+		std::mutex							   m_lockMutex{};
+		std::unordered_map<std::wstring, intptr_t> m_locks{}; // Open lock files, file descriptors or handles
+	};
+
+	// Read only array of trivially copyable T kept in a derived data cache entry, see AssetManager::shared
+	template <typename T>
+	class SharedArray {
+	public:
+		SharedArray() = default;
+
+		std::span<const T> span() const { return m_items; }
+		const T* data() const { return m_items.data(); }
+		size_t size() const { return m_items.size(); }
+		bool empty() const { return m_items.empty(); }
+		const T& operator[](size_t i) const { return m_items[i]; }
+		auto begin() const { return m_items.begin(); }
+		auto end() const { return m_items.end(); }
+
+		size_t memoryUsage() const { return m_items.size_bytes(); }
+
+	private:
+		friend class AssetManager;
+
+		SharedArray(std::shared_ptr<const FileView> file)
+			: m_file(std::move(file))
+			, m_items(reinterpret_cast<const T*>(m_file->data().data()), m_file->data().size() / sizeof(T))
+		{ }
+
+		std::shared_ptr<const FileView> m_file{};
+		std::span<const T>				m_items{};
+	};
 
 private:
 	template <typename F>
@@ -49,30 +510,62 @@ private:
 		const wchar_t* extension;
 		Execution	   policy;
 		F&&			   func;
-		Extension(const wchar_t* _extension, F&& _func, Execution _policy = Execution::Sync)
-			: extension(_extension), func(std::forward<F&&>(_func)), policy(_policy) 
+		LoadOptions	   options;
+		Extension(const wchar_t* _extension, F&& _func, Execution _policy = Execution::Sync, LoadOptions _options = {})
+			: extension(_extension), policy(_policy), func(std::forward<F&&>(_func)), options(_options)
 		{ }
 	};
 
+public:
+	// Stable reference to an asset, resolved once from its path through Directory::handle.
+	// Goes stale (NotFound) once the asset is erased, even if the path reappears later.
+	template <typename T>
+	struct AssetHandle {
+		uint32_t index = UINT32_MAX;
+		uint32_t generation = 0;
+	};
+
 private:
 	template <typename T>
 	using PathToTMap = std::unordered_map<std::wstring, T>;
 
+#ifdef ASSET_MANAGER_NATIVE_FILE_SYSTEM
+	using ifstream = std::ifstream;
+	using ofstream = std::ofstream;
+#else
+	using ifstream = AssetManager_filesystem::ifstream;
+	using ofstream = AssetManager_filesystem::ofstream;
+#endif
+
 private:
+	// Compile time type id. The tag is mutable so identical COMDAT folding can't merge two types' tags.
+	template <typename T>
+	struct TypeTag { inline static char value = 0; };
+
+	using TypeId = const void*;
+
+	template <typename T>
+	static constexpr TypeId typeId = &TypeTag<std::decay_t<T>>::value;
+
 	// Mostly same as std::any with the notable difference of 
 	// allowing T to be a type with deleted copy constructor. 
+	// Types up to c_inlineSize bytes are stored inline, larger ones on the heap.
 	struct MoveOnlyAny {
-		MoveOnlyAny(uintptr_t type) 
-			: m_storage(nullptr)
-			, m_type(type) 
+		static constexpr size_t c_inlineSize  = 6 * sizeof(void*);
+		static constexpr size_t c_inlineAlign = alignof(std::max_align_t);
+
+		MoveOnlyAny(TypeId type) 
+			: m_type(type) 
 		{ }
 		MoveOnlyAny() { }
 		MoveOnlyAny(MoveOnlyAny&& other) noexcept
-			: m_storage(other.m_storage)
+			: m_vtable(other.m_vtable)
 			, m_type(other.m_type)
 		{
-			other.m_storage = nullptr;
-			other.m_type = reinterpret_cast<uintptr_t>(nullptr);
+			if (m_vtable)
+				m_vtable->move(other, *this);
+			other.m_vtable = nullptr;
+			other.m_type = nullptr;
 		}
 
 		template <typename T, typename... Args>
@@ -81,18 +574,23 @@ private:
 			static_assert(std::move_constructible<T>, "Type T needs to be move constructable.");
 
 			reset();
-			m_storage = new char[sizeof(T)];
-			new (m_storage) T(std::forward<Args&&>(args)...);
-			m_type = reinterpret_cast<uintptr_t>(&typeid(std::decay_t<T>));
-			m_destructor = [this] { get<T>().~T(); };
+			if constexpr (c_fitsInline<T>)
+				new (m_inline) T(std::forward<Args&&>(args)...);
+			else
+				m_heap = new T(std::forward<Args&&>(args)...);
+			m_vtable = &c_vtable<T>;
+
+			// Type is usually set on construction, don't write it from loader threads if so
+			if (m_type != typeId<T>)
+				m_type = typeId<T>;
 		}
 
 		template <typename T>
 		T& get() 
 		{
-			if (*typeInfo() != typeid(std::decay_t<T>))
+			if (!is_type<T>())
 				throw std::bad_any_cast{};
-			return *reinterpret_cast<T*>(m_storage);
+			return *ptr<T>();
 		}
 
 		template <typename T>
@@ -100,63 +598,183 @@ private:
 		{
 			if (!is_type<T>())
 				throw std::bad_any_cast{};
-			return *reinterpret_cast<T*>(m_storage);
+			return *const_cast<MoveOnlyAny*>(this)->ptr<T>();
 		}
 
 		bool has_value() const {
-			return m_storage != nullptr;
+			return m_vtable != nullptr;
 		}
 
 		template <typename T>
 		bool is_type() const {
-			if (m_type == 0)
-				return false;
-			return *typeInfo() == typeid(std::decay_t<T>);
+			return m_type == typeId<T>;
 		}
 
-		~MoveOnlyAny() { reset(); }
-	private:
-		void*	  m_storage  = nullptr;
-		uintptr_t m_type	 = reinterpret_cast<uintptr_t>(nullptr);
-		std::function<void()> m_destructor{};
+		TypeId type() const {
+			return m_type;
+		}
+
+		// Bytes held by the value, T::memoryUsage() if it has one and sizeof(T) otherwise
+		size_t memoryUsage() {
+			return m_vtable ? m_vtable->memoryUsage(*this) : 0;
+		}
 
 		void reset() {
-			if (!m_storage)
+			if (!m_vtable)
 				return;
 
-			m_destructor();
-			delete m_storage;
+			// Type is kept, it's the expected type of the asset
+			m_vtable->destroy(*this);
+			m_vtable = nullptr;
+		}
+
+		~MoveOnlyAny() { reset(); }
+	private:
+		struct VTable {
+			void (*destroy)(MoveOnlyAny&) noexcept;
+			void (*move)(MoveOnlyAny& from, MoveOnlyAny& to) noexcept; // Leaves from empty
+			size_t (*memoryUsage)(MoveOnlyAny&);
+		};
+
+		template <typename T>
+		static constexpr bool c_fitsInline = sizeof(T) <= c_inlineSize 
+			&& alignof(T) <= c_inlineAlign 
+			&& std::is_nothrow_move_constructible_v<T>;
+
+		union {
+			alignas(c_inlineAlign) std::byte m_inline[c_inlineSize];
+			void*							 m_heap;
+		};
+		const VTable* m_vtable = nullptr; // Null while empty
+		TypeId		  m_type   = nullptr;
+
+		template <typename T>
+		T* ptr() {
+			if constexpr (c_fitsInline<T>)
+				return std::launder(reinterpret_cast<T*>(m_inline));
+			else
+				return static_cast<T*>(m_heap);
+		}
+
+		template <typename T>
+		static void destroy(MoveOnlyAny& any) noexcept {
+			if constexpr (c_fitsInline<T>)
+				any.ptr<T>()->~T();
+			else
+				delete any.ptr<T>();
+		}
 
-			m_destructor = {};
-			m_storage = nullptr;
-			m_type = reinterpret_cast<uintptr_t>(nullptr);
+		template <typename T>
+		static void move(MoveOnlyAny& from, MoveOnlyAny& to) noexcept {
+			if constexpr (c_fitsInline<T>) {
+				new (to.m_inline) T(std::move(*from.ptr<T>()));
+				from.ptr<T>()->~T();
+			}
+			else
+				to.m_heap = from.m_heap;
 		}
 
-		const std::type_info* typeInfo() const {
-			return reinterpret_cast<const type_info*>(m_type);
+		template <typename T>
+		static size_t memoryUsage(MoveOnlyAny& any) {
+			return valueBytes(*any.ptr<T>());
 		}
+
+		template <typename T>
+		static constexpr VTable c_vtable = { &destroy<T>, &move<T>, &memoryUsage<T> };
 	};
 
 private:
+	template <typename T>
+	static size_t valueBytes(const T& value) {
+		if constexpr (requires { { value.memoryUsage() } -> std::convertible_to<size_t>; })
+			return value.memoryUsage();
+		else
+			return sizeof(T);
+	}
+
+	// Type created by an init handler taking a path or a FileView, or by the upload of a staged one
+	template <typename F>
+	struct InitResultOf {
+		using type = typename std::conditional_t<std::is_invocable_v<F, const wchar_t*>, 
+			std::invoke_result<F, const wchar_t*>, std::invoke_result<F, const FileView&>>::type;
+	};
+
+	template <typename Decode, typename Upload>
+	struct InitResultOf<Staged<Decode, Upload>> {
+		using type = std::invoke_result_t<Upload, typename InitResultOf<Decode>::type&&>;
+	};
+
+	template <typename F>
+	using InitResult = typename InitResultOf<std::decay_t<F>>::type;
+
+	static std::unique_ptr<FileView> mapFile(const wchar_t* path) {
+		auto view = openFile(path);
+		if (!view)
+			throw std::runtime_error("Failed to map asset file");
+		return view;
+	}
+
+	// Decode phase of a staged handler, taking a path or a FileView
+	template <typename Decode>
+	static InitResult<Decode> decode(const Decode& decode, const wchar_t* path) {
+		if constexpr (std::is_invocable_v<Decode, const wchar_t*>)
+			return std::invoke(decode, path);
+		else
+			return std::invoke(decode, *mapFile(path));
+	}
+
+	// Upload phase of the staged handler running on this thread
+	inline static thread_local UploadTask* s_upload = nullptr;
+
+	// Hand the upload phase to the running load, or run it right away outside of one
+	static void stage(size_t bytes, std::function<void()>&& work) {
+		if (!s_upload)
+			return work();
+		s_upload->bytes = bytes;
+		s_upload->work = std::move(work);
+	}
+
 	struct Initialize {
 		Initialize(const Initialize&) = default;
 		Initialize(Initialize&&) = default;
 		template <typename Functor>
-			requires(not std::is_same_v<std::decay_t<Functor>, Initialize>)
+			requires(not std::is_same_v<std::decay_t<Functor>, Initialize> && std::is_invocable_v<Functor, const wchar_t*>)
 		Initialize(Functor&& func)
 			: m_func{[func = std::forward<Functor&&>(func)](MoveOnlyAny& storage, const wchar_t* path) 
 				{ storage.emplace<decltype(func(path))>(func(path)); }}
 		{ }
+		template <typename Functor>
+			requires(not std::is_same_v<std::decay_t<Functor>, Initialize> && std::is_invocable_v<Functor, const FileView&>)
+		Initialize(Functor&& func)
+			: m_func{[func = std::forward<Functor&&>(func)](MoveOnlyAny& storage, const wchar_t* path) { 
+				auto view = mapFile(path);
+				storage.emplace<InitResult<Functor>>(func(*view)); 
+			}}
+		{ }
 		template <typename T>
 		Initialize(T (*func)(const wchar_t*))
 			: m_func([func](MoveOnlyAny& storage, const wchar_t* path) { storage.emplace<T>(func(path)); })
 		{ }
+		template <typename Decode, typename Upload>
+			requires(std::is_invocable_v<Upload, InitResult<Decode>&&>)
+		Initialize(Staged<Decode, Upload> staged)
+			: m_func{[staged](MoveOnlyAny& storage, const wchar_t* path) {
+				auto decoded = std::make_shared<InitResult<Decode>>(decode(staged.decode, path));
+				stage(valueBytes(*decoded), [&storage, upload = staged.upload, decoded] { 
+					storage.emplace<InitResult<Staged<Decode, Upload>>>(std::invoke(upload, std::move(*decoded))); 
+				});
+			}}
+			, m_staged(true)
+		{ }
 
 		void operator()(MoveOnlyAny& storage, const wchar_t* path) {
 			m_func(storage, path);
 		}
+
+		bool staged() const { return m_staged; }
 	private:
 		std::function<void(MoveOnlyAny&, const wchar_t*)> m_func;
+		bool											   m_staged = false;
 	};
 
 	struct Update {
@@ -171,293 +789,2114 @@ private:
 		Update(auto (T::*func)(const wchar_t*))
 			: m_func([func](MoveOnlyAny& storage, const wchar_t* path) { (storage.get<T>().*func)(path); })
 		{ }
+		template <typename T, typename Ret>
+		Update(std::function<Ret(T&, const FileView&)> func)
+			: m_func{[func](MoveOnlyAny& storage, const wchar_t* path) 
+				{ func(storage.get<T>(), *mapFile(path)); }}
+		{ }
+		template <typename T>
+		Update(auto (T::*func)(const FileView&))
+			: m_func([func](MoveOnlyAny& storage, const wchar_t* path) { (storage.get<T>().*func)(*mapFile(path)); })
+		{ }
+		template <typename Decode, typename T, typename Ret, typename D>
+		Update(Staged<Decode, Ret (T::*)(D)> staged)
+			: m_func{[staged](MoveOnlyAny& storage, const wchar_t* path) {
+				auto decoded = std::make_shared<InitResult<Decode>>(decode(staged.decode, path));
+				stage(valueBytes(*decoded), [&storage, upload = staged.upload, decoded] { 
+					(storage.get<T>().*upload)(std::move(*decoded)); 
+				});
+			}}
+			, m_staged(true)
+		{ }
 
 		void operator()(MoveOnlyAny& storage, const wchar_t* path) {
 			m_func(storage, path);
 		}
+
+		bool staged() const { return m_staged; }
 	private:
 		std::function<void(MoveOnlyAny&, const wchar_t*)> m_func;
+		bool											   m_staged = false;
+	};
+
+	// Declared by a handler through dependsOn, with the write time of the file at that point
+	struct Dependency {
+		std::wstring							path;
+		AssetManager_filesystem::file_time_type writeTime;
+	};
+
+	// Receives the dependencies a handler declared, once it returns
+	using DependencySink = std::function<void(std::vector<Dependency>&&)>;
+
+	// Handed to the thread running a handler
+	struct LoadContext {
+		DependencySink sink{};
+		const Pack*	   pack = nullptr;	  // Files are read from this pack instead of the file system
+		UploadQueue*   uploads = nullptr; // Upload phases of staged handlers go here, they run right away without one
+		DerivedDataCache* cache = nullptr;
+	};
+
+	// Dependencies declared by, pack mounted for and cache used by the handler running on this thread
+	inline static thread_local std::vector<Dependency>* s_dependencies = nullptr;
+	inline static thread_local const Pack*				s_pack = nullptr;
+	inline static thread_local DerivedDataCache*		s_cache = nullptr;
+
+	struct Load {
+		std::future<void>			future;
+		std::shared_ptr<LoadTask>	task = nullptr;	  // Set for loads queued on the scheduler
+		std::shared_ptr<UploadTask> upload = nullptr; // Set for staged handlers, the load resolves once it finished
 	};
 
 	template <class T>
 		requires(std::is_same_v<T, Initialize> || std::is_same_v<T, Update>)
 	struct Handler {
 		template <typename U>
-		Handler(U&& func, Execution policy)
+		Handler(U&& func, Execution policy, LoadOptions options = {})
 			: m_functor(std::forward<U&&>(func))
 			, m_policy(policy)
+			, m_options(options)
 		{ }
 
-		std::future<void> operator()(MoveOnlyAny& storage, const wchar_t* path) {
+		Load operator()(MoveOnlyAny& storage, const wchar_t* path, LoadScheduler& scheduler, LoadContext context = {}) {
+			auto upload = m_functor.staged() ? std::make_shared<UploadTask>() : nullptr;
+
+			// Handlers are never erased from their map, so this stays valid
+			auto run = [this, &storage, path, context = std::move(context), upload] {
+				std::vector<Dependency> dependencies;
+				// Restores the outer handler's state, loads can run inline inside another handler
+				struct Record {
+					Record(std::vector<Dependency>* dependencies, const LoadContext& context, UploadTask* upload) 
+						: previousDependencies(std::exchange(s_dependencies, dependencies))
+						, previousPack(std::exchange(s_pack, context.pack))
+						, previousCache(std::exchange(s_cache, context.cache))
+						, previousUpload(std::exchange(s_upload, upload))
+					{ }
+					~Record() { 
+						s_dependencies = previousDependencies; 
+						s_pack = previousPack;
+						s_cache = previousCache;
+						s_upload = previousUpload;
+					}
+					std::vector<Dependency>*   previousDependencies;
+					const Pack*				   previousPack;
+					DerivedDataCache*		   previousCache;
+					UploadTask*				   previousUpload;
+				} record(&dependencies, context, upload.get());
+
+				try {
+					m_functor(storage, path);
+				}
+				catch (...) {
+					if (upload)
+						upload->skip();
+					throw;
+				}
+				if (context.sink)
+					context.sink(std::move(dependencies));
+
+				// Sync handlers running on the upload thread upload right away, others leave it to that thread
+				if (!upload)
+					return;
+				if (!context.uploads || !upload->work || (m_policy == Execution::Sync && context.uploads->onUploadThread()))
+					upload->run();
+				else
+					context.uploads->push(upload);
+			};
+
 			if (m_policy == Execution::Sync) {
 				std::promise<void> promise;
 				try { // Call functor and pass exceptions to future
-					m_functor(storage, path);
+					run();
+					promise.set_value();
 				}
 				catch (...) {
 					promise.set_exception(std::current_exception());
 				}
-				return promise.get_future();
+				return { promise.get_future(), nullptr, upload };
+			}
+			else if (m_policy == Execution::Async) {
+				auto task = scheduler.submit(std::move(run), m_options);
+				return { task->promise.get_future(), task, upload };
 			}
-			else { // Async or Deferred
-				return std::async((std::launch)m_policy, m_functor, std::ref(storage), path);
+			else { // Deferred
+				return { std::async(std::launch::deferred, std::move(run)), nullptr, upload };
 			}
 		}
+
+		const LoadOptions& options() const { return m_options; }
+		Execution policy() const { return m_policy; }
 	private:
-		T		  m_functor;
-		Execution m_policy;
+		T		    m_functor;
+		Execution   m_policy;
+		LoadOptions m_options;
 	};
 
 private:
 	class Asset {
 	public:
 		Asset(MoveOnlyAny&& any)
-			: m_storage(std::move(any))
+			: m_storage(std::make_shared<MoveOnlyAny>(std::move(any)))
+			, m_current(m_storage.load().get())
 			, m_fut(std::nullopt)
 			, m_semaphore(1)
 		{ }
 
 		template <typename T>
 		T& get() { 
-			return m_storage.get<T>(); 
+			return storage().get<T>(); 
+		}
+
+		// Current version, kept alive for as long as the returned pointer
+		template <typename T>
+		std::shared_ptr<T> pin() {
+			std::shared_ptr<MoveOnlyAny> storage = m_storage.load();
+			return std::shared_ptr<T>(storage, &storage->get<T>());
 		}
 
 		void tryResolve() {
+			// Resolved assets skip the semaphore and the future
+			if (m_resolved.load(std::memory_order_acquire))
+				return;
+
 			m_semaphore.acquire();
+			startDeferred();
 
 			if (!unresolved())
-				return m_semaphore.release();
+				return resolve();
 
-			m_fut.value().wait();
-			m_fut.reset();
+			if (m_fut.has_value()) {
+				m_fut.value().wait();
+				m_fut.reset();
+			}
+
+			// On the upload thread, upload right away rather than wait for AssetManager::upload.
+			// Others wait without the semaphore, the upload thread may need it to get this asset.
+			if (m_upload && !m_upload->finished) {
+				std::shared_ptr<UploadTask> upload = m_upload;
+				m_semaphore.release();
+				upload->resolve();
+				return tryResolve();
+			}
+
+			resolve();
+		}
 
+		// tryResolve, then finish a versioned reload without publishing it
+		void wait() {
+			tryResolve();
+			if (!m_next)
+				return;
+			if (m_next->future.has_value())
+				m_next->future.value().wait();
+			if (m_next->upload)
+				m_next->upload->resolve();
+		}
+
+		// Start a load postponed by defer without waiting for it. Skipped while another thread holds
+		// the semaphore, that thread starts the load itself.
+		void start() {
+			if (m_resolved.load(std::memory_order_acquire))
+				return;
+			if (!m_semaphore.try_acquire())
+				return;
+			startDeferred();
 			m_semaphore.release();
 		}
 
+		// Non-blocking tryResolve, returns false while the load is in flight or another thread holds the semaphore.
+		// Loads with the Deferred policy run here, they only ever run on access.
+		bool poll() {
+			if (m_resolved.load(std::memory_order_acquire))
+				return true;
+			if (!m_semaphore.try_acquire())
+				return false;
+			startDeferred();
+
+			if (m_fut.has_value()) {
+				auto status = m_fut.value().wait_for(std::chrono::milliseconds(0));
+				if (status == std::future_status::timeout)
+					return m_semaphore.release(), false;
+				m_fut.value().wait();
+			}
+
+			// Decoded but waiting for AssetManager::upload
+			if (m_upload && !m_upload->finished)
+				return m_semaphore.release(), false;
+
+			resolve();
+			return true;
+		}
+
 		bool unresolved() const {
-			return m_fut.has_value() 
-				&& std::future_status::ready != m_fut.value().wait_for(std::chrono::milliseconds(0));
+			return !m_resolved.load(std::memory_order_acquire) && !finished(m_fut, m_upload);
+		}
+
+		// Load in flight or versioned reload not published yet
+		bool busy() const {
+			return unresolved() || m_next.has_value();
 		}
 
 		template <typename T>
 		bool is_type() const {
-			return m_storage.is_type<T>();
+			return storage().is_type<T>();
 		}
 
 		bool has_value() const {
-			return m_storage.has_value();
+			return storage().has_value();
 		}
 
-		template<typename T>
-		void handle(Handler<T>& handler, const wchar_t* path) {
-			m_fut.emplace(handler(m_storage, path));
+		bool deferred() const {
+			return m_deferred != nullptr;
+		}
+
+		TypeId type() const {
+			return storage().type();
+		}
+
+		size_t memoryUsage() {
+			return storage().memoryUsage();
+		}
+
+		template<typename T>
+		void handle(Handler<T>& handler, const wchar_t* path, LoadScheduler& scheduler, LoadContext context = {}) {
+			// Built next to the current version, which readers keep until publish
+			if (handler.options().versioned && has_value()) {
+				auto storage = std::make_shared<MoveOnlyAny>(type());
+				Load load = handler(*storage, path, scheduler, std::move(context));
+				m_next.emplace(std::move(storage), std::move(load.future), std::move(load.task), std::move(load.upload));
+				return;
+			}
+
+			Load load = handler(storage(), path, scheduler, std::move(context));
+			m_semaphore.acquire();
+			m_resolved.store(false, std::memory_order_relaxed);
+			m_deferred = nullptr;
+			m_fut.emplace(std::move(load.future));
+			m_task = std::move(load.task);
+			m_upload = std::move(load.upload);
+			m_semaphore.release();
+		}
+
+		// Make a finished versioned reload current. Returns the replaced version, or nullptr if nothing was published.
+		std::shared_ptr<MoveOnlyAny> publish() {
+			if (!m_next)
+				return nullptr;
+
+			// Reloads with the Deferred policy run here
+			Version& next = *m_next;
+			if (next.future.has_value() 
+				&& next.future.value().wait_for(std::chrono::milliseconds(0)) == std::future_status::deferred)
+				next.future.value().wait();
+			if (!finished(next.future, next.upload))
+				return nullptr;
+
+			// Failed reloads keep the current version
+			std::shared_ptr<MoveOnlyAny> storage = std::move(next.storage);
+			m_next.reset();
+			if (!storage->has_value())
+				return nullptr;
+
+			m_current.store(storage.get(), std::memory_order_release);
+			return m_storage.exchange(std::move(storage));
+		}
+
+		bool building() const {
+			return m_next.has_value();
+		}
+
+		// Current version shared with a pin, besides this member and the loaded copy
+		bool pinned() const {
+			return m_storage.load().use_count() > 2;
+		}
+
+		// Run handler on first access instead of now
+		template<typename T>
+		void defer(Handler<T>& handler, const wchar_t* path, LoadScheduler& scheduler, LoadContext context = {}) {
+			m_semaphore.acquire();
+			m_resolved.store(false, std::memory_order_relaxed);
+			m_deferred = [&handler, path, &scheduler, context = std::move(context), this] { 
+				return handler(storage(), path, scheduler, context); 
+			};
+			m_semaphore.release();
+		}
+
+		// Drop resolved value, handler reloads it on next access. The reload gets new storage, pins keep the old one.
+		template<typename T>
+		void evict(Handler<T>& handler, const wchar_t* path, LoadScheduler& scheduler, LoadContext context = {}) {
+			auto storage = std::make_shared<MoveOnlyAny>(type());
+			m_current.store(storage.get(), std::memory_order_release);
+			m_storage.store(std::move(storage));
+			m_fut.reset();
+			m_task.reset();
+			m_upload.reset();
+			m_next.reset();
+			defer(handler, path, scheduler, std::move(context));
+		}
+
+		// Drop queued load, upload or versioned reload, fails if it already started or the load isn't on the scheduler
+		bool cancel() {
+			if (m_next) {
+				if (!finished(m_next->future, m_next->upload) && !cancel(m_next->future, m_next->task, m_next->upload))
+					return false;
+				m_next.reset();
+				return true;
+			}
+
+			return unresolved() && cancel(m_fut, m_task, m_upload);
+		}
+
+		bool reprioritize(LoadScheduler& scheduler, int priority) {
+			return m_task && unresolved() && scheduler.reprioritize(m_task, priority);
+		}
+
+		~Asset() {
+			// Queued or running loads and uploads reference the storage
+			if (m_next)
+				abandon(m_next->future, m_next->task, m_next->upload);
+			abandon(m_fut, m_task, m_upload);
 		}
 
 	private:
-		MoveOnlyAny						 m_storage;
+		// Versioned reload in flight
+		struct Version {
+			std::shared_ptr<MoveOnlyAny>	 storage;
+			std::optional<std::future<void>> future;
+			std::shared_ptr<LoadTask>		 task;
+			std::shared_ptr<UploadTask>		 upload;
+		};
+
+		// Current version. Readers go through the raw pointer, pins share ownership.
+		std::atomic<std::shared_ptr<MoveOnlyAny>> m_storage;
+		std::atomic<MoveOnlyAny*>				  m_current;
+		std::optional<Version>					  m_next{};
+
 		std::optional<std::future<void>> m_fut;
+		std::shared_ptr<LoadTask>		 m_task{};
+		std::shared_ptr<UploadTask>		 m_upload{};
+		std::function<Load()>			 m_deferred{};
 		std::binary_semaphore			 m_semaphore;
+		std::atomic<bool>				 m_resolved = true; // No load, upload or deferred load pending
+
+	private:
+		MoveOnlyAny& storage() const {
+			return *m_current.load(std::memory_order_acquire);
+		}
+
+		// Drop the finished load and publish its result to the fast path, releases the semaphore
+		void resolve() {
+			m_fut.reset();
+			m_task.reset();
+			m_upload.reset();
+			m_resolved.store(true, std::memory_order_release);
+			m_semaphore.release();
+		}
+
+		// Start load postponed by defer, semaphore must be held
+		void startDeferred() {
+			if (!m_deferred)
+				return;
+			Load load = std::exchange(m_deferred, nullptr)();
+			m_fut.emplace(std::move(load.future));
+			m_task = std::move(load.task);
+			m_upload = std::move(load.upload);
+		}
+
+		static bool finished(const std::optional<std::future<void>>& future, const std::shared_ptr<UploadTask>& upload) {
+			return (!future.has_value() || std::future_status::ready == future.value().wait_for(std::chrono::milliseconds(0)))
+				&& (!upload || upload->finished);
+		}
+
+		static bool cancel(std::optional<std::future<void>>& future, std::shared_ptr<LoadTask>& task, std::shared_ptr<UploadTask>& upload) {
+			bool decoded = !future.has_value() 
+				|| std::future_status::ready == future.value().wait_for(std::chrono::milliseconds(0));
+			if (decoded) {
+				if (!upload || !upload->skip())
+					return false;
+			}
+			else {
+				if (!task || !task->cancel())
+					return false;
+				if (upload)
+					upload->skip();
+			}
+			task.reset();
+			upload.reset();
+			return true;
+		}
+
+		// Cancel or wait for a load about to lose its storage
+		static void abandon(std::optional<std::future<void>>& future, std::shared_ptr<LoadTask>& task, std::shared_ptr<UploadTask>& upload) {
+			bool cancelled = !finished(future, upload) && cancel(future, task, upload);
+			if (task && !cancelled && future.has_value())
+				future.value().wait();
+			if (upload && !upload->skip())
+				upload->wait();
+		}
 	};
 
 private:
+	// Everything known about one asset, kept together so a handle lookup touches one record
+	struct AssetRecord {
+		std::wstring							 path{};
+		std::optional<Asset>					 asset{}; // Empty while the record is free
+		AssetManager_filesystem::file_time_type writeTime{};
+		uint64_t								 contentHash = 0; // Only computed with Directory::hashContents
+		unsigned								 syncStamp = 0;  // Sync count of the last visit
+		uint32_t								 generation = 0; // Bumped on erase
+		std::atomic<unsigned>					 lastAccess = 0; // Frame of the last get, stamped by concurrent readers
+		std::atomic<unsigned>					 recorded = 0;	 // Access recording the record was last logged in
+		std::vector<std::wstring>				 dependencies{}; // Normalized paths declared by the last load
+		TypeId									 type = nullptr; // Key of the per-type index
+		uint32_t								 typeSlot = 0;	 // Position in the per-type index
+
+		// Only stores when the frame changed, readers of a hot asset don't contend on the record
+		void touch(unsigned frame) {
+			if (lastAccess.load(std::memory_order_relaxed) != frame)
+				lastAccess.store(frame, std::memory_order_relaxed);
+		}
+
+		// Returns true for exactly one caller on the first access during the given recording
+		bool record(unsigned recording) {
+			unsigned last = recorded.load(std::memory_order_relaxed);
+			return last != recording && recorded.compare_exchange_strong(last, recording, std::memory_order_relaxed);
+		}
+	};
+
+	// Assets of type T, walks the per-type index of a directory. Waiting collections are resolved by getAll.
 	template <typename T>
 	struct AssetCollection {
-		struct iterator : public IteratorBase<iterator, PathToTMap<Asset>::iterator> {
-			using Base = IteratorBase<iterator, PathToTMap<Asset>::iterator>;
+		struct iterator : public IteratorBase<iterator, std::vector<uint32_t>::const_iterator> {
+			using Base = IteratorBase<iterator, std::vector<uint32_t>::const_iterator>;
 		public:
-			iterator(Base::iter it, Base::iter end) : Base(it, end) {
-				while (Base::m_it != Base::m_end && !Base::m_it->second.is_type<T>())
+			iterator(Base::iter it, Base::iter end, std::deque<AssetRecord>& records, unsigned frame, bool wait) 
+				: Base(it, end)
+				, m_records(records)
+				, m_frame(frame) 
+				, m_wait(wait)
+			{
+				skip();
+			}
+
+			std::pair<const std::wstring&, T&> operator*() {
+				AssetRecord& record = m_records[*Base::m_it];
+				record.touch(m_frame);
+				return { record.path, record.asset->template get<T>() };
+			}
+
+			iterator& operator++() { 
+				++Base::m_it;
+				skip();
+				return *this; 
+			}
+		private:
+			std::deque<AssetRecord>& m_records;
+			unsigned				 m_frame;
+			bool					 m_wait;
+
+			// Skip failed loads and, if not waiting, assets still loading
+			void skip() {
+				while (Base::m_it != Base::m_end && !accept(m_records[*Base::m_it]))
 					++Base::m_it;
 			}
 
-			std::pair<const std::wstring&, T&> operator*() {
-				// Resolve future if unresolved
-				Base::m_it->second.tryResolve();
+			bool accept(AssetRecord& record) const {
+				return (m_wait || record.asset->poll()) && record.asset->has_value();
+			}
+		};
+
+		AssetCollection(std::deque<AssetRecord>& records, const std::vector<uint32_t>& indices, unsigned frame, bool wait) 
+			: m_records(records)
+			, m_indices(indices)
+			, m_frame(frame) 
+			, m_wait(wait)
+		{ }
+
+		iterator begin() { return iterator(m_indices.begin(), m_indices.end(), m_records, m_frame, m_wait); }
+
+		iterator end() { return iterator(m_indices.end(), m_indices.end(), m_records, m_frame, m_wait); }
+
+		size_t size() const { return m_indices.size(); }
+	private:
+		std::deque<AssetRecord>&	 m_records;
+		const std::vector<uint32_t>& m_indices;
+		unsigned					 m_frame;
+		bool						 m_wait;
+	};
+
+private:
+	class Directory {
+	public:
+		Directory(AssetManager& manager, const wchar_t* path)
+			: m_assetManager(manager)
+			, m_path(path)
+		{ }
+
+		template <typename T>
+			requires(std::constructible_from<Initialize, T> && not std::constructible_from<Update, T>)
+		void assing(const wchar_t* extension, T&& function, Execution policy = Execution::Sync, LoadOptions options = {}) {
+			waitForScan();
+			m_listings.clear();
+			using R = InitResult<T>;
+			m_typeInfos.insert({ extension, { typeId<R>, typeid(R).name() } });
+			m_initHandlers.insert({ extension, Handler<Initialize>(std::forward<T&&>(function), policy, options)});
+		}
+
+		template <typename T>
+			requires(std::constructible_from<Update, T>)
+		void assing(const wchar_t* extension, T&& function, Execution policy = Execution::Sync, LoadOptions options = {}) {
+			waitForScan();
+			m_updateHandlers.insert({ extension, Handler<Update>(std::forward<T&&>(function), policy, options)});
+		}
+
+		template <typename... Ts>
+			requires((std::constructible_from<Initialize, Ts> || std::constructible_from<Update, Ts>) && ...)
+		void assing(Extension<Ts>&&... extensionHandlers) {
+			(assing(extensionHandlers.extension, std::forward<Ts&&>(extensionHandlers.func), 
+				extensionHandlers.policy, extensionHandlers.options), ...);
+		}
+
+		template <typename F>
+		Extension<F> ext(const wchar_t* path, F&& func, Execution policy = Execution::Sync, LoadOptions options = {}) {
+			return m_assetManager.ext(path, std::forward<F&&>(func), policy, options);
+		}
+
+		// Move a queued load of path to another priority, returns false if it isn't queued
+		bool prioritize(const wchar_t* path, int priority) {
+			AssetRecord* record = find(path);
+			if (!record)
+				return false;
+			return record->asset->reprioritize(m_assetManager.m_scheduler, priority);
+		}
+
+		// Resolve path once, later lookups through the handle are an index into the asset records
+		template <typename T>
+		std::expected<AssetHandle<T>, AssetReturnStatus> handle(const wchar_t* path) const {
+			auto indexIt = m_index.find(path);
+			if (indexIt == m_index.end())
+				return std::unexpected(AssetReturnStatus::NotFound);
+
+			const AssetRecord& record = m_records[indexIt->second];
+			if (!record.asset->template is_type<T>())
+				return std::unexpected(AssetReturnStatus::TypeMismatch);
+
+			return AssetHandle<T>{ indexIt->second, record.generation };
+		}
+
+		template <typename T>
+		std::expected<std::reference_wrapper<T>, AssetReturnStatus> get_exp(AssetHandle<T> handle) {
+			// Return NotFound if slot was erased or reused since the handle was resolved
+			if (handle.index >= m_records.size())
+				return std::unexpected(AssetReturnStatus::NotFound);
+			AssetRecord& record = m_records[handle.index];
+			if (record.generation != handle.generation || !record.asset)
+				return std::unexpected(AssetReturnStatus::NotFound);
+
+			return get_exp<T>(record);
+		}
+
+		template <typename T>
+		std::expected<std::reference_wrapper<T>, AssetReturnStatus> get_exp(const wchar_t* path) {
+			// Find asset or return NotFound
+			AssetRecord* record = find(path);
+			if (!record)
+				return std::unexpected(AssetReturnStatus::NotFound);
+
+			return get_exp<T>(*record);
+		}
+
+		template <typename T>
+		T& get(const wchar_t* path) {
+			return get_exp<T>(path).value();
+		}
+
+		template <typename T>
+		T& get(AssetHandle<T> handle) {
+			return get_exp<T>(handle).value();
+		}
+
+		// Shared ownership of the current version. References returned by get stay valid until the synchronize after
+		// the one publishing a versioned reload, or the next synchronize for evictable types, pins for as long as they
+		// are held. Returns nullptr where get_exp fails.
+		template <typename T>
+		std::shared_ptr<T> pin(const wchar_t* path) {
+			AssetRecord* record = find(path);
+			if (!record || !get_exp<T>(*record))
+				return nullptr;
+			return record->asset->template pin<T>();
+		}
+
+		template <typename T>
+		std::shared_ptr<T> pin(AssetHandle<T> handle) {
+			if (!get_exp<T>(handle))
+				return nullptr;
+			return m_records[handle.index].asset->template pin<T>();
+		}
+
+		// Like get_exp but returns Pending instead of waiting for a load in flight
+		template <typename T>
+		std::expected<std::reference_wrapper<T>, AssetReturnStatus> try_get(const wchar_t* path) {
+			AssetRecord* record = find(path);
+			if (!record)
+				return std::unexpected(AssetReturnStatus::NotFound);
+
+			return try_get<T>(*record);
+		}
+
+		template <typename T>
+		std::expected<std::reference_wrapper<T>, AssetReturnStatus> try_get(AssetHandle<T> handle) {
+			if (handle.index >= m_records.size())
+				return std::unexpected(AssetReturnStatus::NotFound);
+			AssetRecord& record = m_records[handle.index];
+			if (record.generation != handle.generation || !record.asset)
+				return std::unexpected(AssetReturnStatus::NotFound);
+
+			return try_get<T>(record);
+		}
+
+		// Loaded asset or, while it's loading, the placeholder set with AssetManager::placeholder<T>.
+		// Loading without a placeholder set for T throws std::logic_error.
+		template <typename T>
+		T& get_or_placeholder(const wchar_t* path) {
+			auto asset = try_get<T>(path);
+			if (!asset && asset.error() == AssetReturnStatus::Pending)
+				return m_assetManager.placeholder<T>();
+			return asset.value();
+		}
+
+		template <typename T>
+		T& get_or_placeholder(AssetHandle<T> handle) {
+			auto asset = try_get<T>(handle);
+			if (!asset && asset.error() == AssetReturnStatus::Pending)
+				return m_assetManager.placeholder<T>();
+			return asset.value();
+		}
+
+		// Call callback from synchronize once the asset has loaded, returns false if there is no such asset
+		template <typename T>
+		bool whenLoaded(const wchar_t* path, std::function<void(T&)> callback) {
+			auto assetHandle = handle<T>(path);
+			return assetHandle && whenLoaded<T>(*assetHandle, std::move(callback));
+		}
+
+		template <typename T>
+		bool whenLoaded(AssetHandle<T> handle, std::function<void(T&)> callback) {
+			if (handle.index >= m_records.size() || m_records[handle.index].generation != handle.generation)
+				return false;
+			m_callbacks.push_back({ handle.index, handle.generation, 
+				[callback = std::move(callback)](Asset& asset) { callback(asset.template get<T>()); } });
+			return true;
+		}
+
+		// Without wait, assets still loading are skipped instead of waited for.
+		// With wait, every load is started before waiting on any of them.
+		template <typename T>
+		AssetCollection<T> getAll(bool wait = true) { 
+			const auto& indices = m_typeIndex[typeId<T>];
+			if (wait)
+				resolveAll(indices);
+			return AssetCollection<T>(m_records, indices, m_frame, wait); 
+		}
+
+		unsigned synchronize(SyncMode mode = SyncMode::Blocking) {
+			// Before the frame advances, so assets used since the last synchronize stay resident
+			evictOverBudget();
+			++m_frame;
+
+			// Only visit touched paths while the watcher hasn't lost any events
+			unsigned synchronizedCount = m_pack 
+				? synchronizePack()
+				: m_watcher && !m_rescanRequired && !m_scan.valid() 
+				? synchronizeWatched(mode) 
+				: rescan(mode);
+
+			// Files were visited unless a background scan is still in flight, packs never change
+			synchronizedCount += reloadDependents(!m_scan.valid() && !m_pack);
+			prefetch();
+			publishVersions();
+			deliverCallbacks();
+			return synchronizedCount;
+		}
+
+		// True while a background scan is in flight
+		bool synchronizing() const {
+			return m_scan.valid();
+		}
+
+		// Detect changes through kernel notifications instead of walking the whole tree on every sync.
+		// Returns false if no watcher is available, synchronize keeps doing full rescans in that case.
+		bool watch([[maybe_unused]] bool enable = true) {
+			waitForScan();
+#ifdef ASSET_MANAGER_NATIVE_FILE_SYSTEM
+			m_watcher = enable && !m_pack ? Watcher::create(m_path) : nullptr;
+#endif
+			m_rescanRequired = true;
+			m_retry.clear();
+			return m_watcher != nullptr;
+		}
+
+		// Serve the directory from a pack instead of the file system, assets load from it on next synchronize.
+		// Handlers see the same paths, but only FileView handlers can read packed files.
+		// Returns false and keeps using the file system if the pack can't be opened.
+		bool mount(const wchar_t* packFile) {
+			waitForScan();
+			auto pack = Pack::open(packFile, m_path);
+			if (!pack)
+				return false;
+
+			// Loads in flight read from the previous pack, deferred ones would once accessed. Finish the former,
+			// make the next synchronize reload the latter.
+			for (uint32_t index = 0; index < m_records.size(); ++index) {
+				AssetRecord& record = m_records[index];
+				if (!record.asset)
+					continue;
+				if (record.asset->busy())
+					settle(index);
+				if (record.asset->deferred())
+					record.writeTime = {};
+			}
+			m_pack = std::move(pack);
+			m_watcher = nullptr;
+			m_rescanRequired = true;
+			m_retry.clear();
+			return true;
+		}
+
+		// Bytes of resolved assets as of the last synchronize, of type T or all types
+		template <typename T>
+		size_t residentBytes() const { return residentBytes(typeId<T>); }
+		size_t residentBytes() const { return residentBytes(nullptr); }
+
+		size_t residentBytes(TypeId type) const {
+			if (!type)
+				return m_residentBytes;
+			auto it = m_residentTypeBytes.find(type);
+			return it != m_residentTypeBytes.end() ? it->second : 0;
+		}
+
+		// Only load files matching an include glob, once any is set, and skip files and whole subtrees matching an
+		// exclude glob. Globs match paths relative to the directory with '/' separators: * stays within a path
+		// segment, ** spans any number of them, ? matches one character. Applies from the next synchronize.
+		void include(std::wstring glob) {
+			waitForScan();
+			m_include.push_back(std::move(glob));
+			m_listings.clear();
+			m_rescanRequired = true;
+		}
+
+		void exclude(std::wstring glob) {
+			waitForScan();
+			m_exclude.push_back(std::move(glob));
+			m_listings.clear();
+			m_rescanRequired = true;
+		}
+
+		// Compare file contents before reloading an asset whose write time changed. Background synchronizes hash
+		// on the scanning threads, others on the synchronizing thread.
+		void hashContents(bool enable = true) {
+			waitForScan();
+			m_hashContents = enable;
+		}
+
+		// Reload changed files only once they stayed unchanged for window, so a burst of writes causes a single reload
+		// of the final contents. First loads aren't delayed, extensions can set a longer window in LoadOptions.
+		void settleWindow(std::chrono::milliseconds window) {
+			waitForScan();
+			m_settleWindow = window;
+		}
+
+		// Write path, size, write time, content hash and handler type of every asset to file
+		bool saveManifest(const std::wstring& file) {
+			waitForScan();
+			std::wstring temporary = file + L".tmp";
+			{
+				ofstream out(AssetManager_filesystem::path(temporary), std::ios::binary);
+				if (!out)
+					return false;
+
+				auto write = [&](const auto& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+				auto writeString = [&](std::string_view string) {
+					write((uint32_t)string.size());
+					out.write(string.data(), string.size());
+				};
+
+				write(c_manifestMagic);
+				write((uint64_t)m_index.size());
+				for (const auto& record : m_records) {
+					if (!record.asset)
+						continue;
+
+					std::error_code error;
+					uint64_t size = AssetManager_filesystem::file_size(record.path, error);
+					std::u8string path = AssetManager_filesystem::path(record.path).u8string();
+					writeString({ reinterpret_cast<const char*>(path.data()), path.size() });
+					write(error ? UINT64_MAX : size);
+					write((int64_t)record.writeTime.time_since_epoch().count());
+					write(record.contentHash);
+					writeString(m_typeInfos.at(fileExtension(record.path).data()).name);
+				}
+				if (!out.flush())
+					return false;
+			}
+
+			// Replace old manifest only once the new one is complete
+			std::error_code error;
+			AssetManager_filesystem::rename(temporary, file, error);
+			return !error;
+		}
+
+		// Assets listed in file and unchanged on disk are loaded on first access by the next synchronize.
+		// Call before the first synchronize, entries not matched by it are dropped.
+		bool loadManifest(const std::wstring& file) {
+			waitForScan();
+			ifstream in(AssetManager_filesystem::path(file), std::ios::binary);
+			if (!in)
+				return false;
+
+			auto read = [&](auto& value) { in.read(reinterpret_cast<char*>(&value), sizeof(value)); };
+			auto readString = [&](std::string& string) {
+				uint32_t size = 0;
+				read(size);
+				string.resize(in ? size : 0);
+				in.read(string.data(), string.size());
+			};
+
+			uint64_t magic = 0, count = 0;
+			read(magic);
+			read(count);
+			if (!in || magic != c_manifestMagic)
+				return false;
+
+			std::string path;
+			for (uint64_t i = 0; i < count; ++i) {
+				ManifestEntry entry;
+				readString(path);
+				read(entry.size);
+				read(entry.writeTime);
+				read(entry.hash);
+				readString(entry.type);
+				if (!in) {
+					m_manifest.clear();
+					return false;
+				}
+				std::u8string_view utf8Path(reinterpret_cast<const char8_t*>(path.data()), path.size());
+				m_manifest.insert_or_assign(AssetManager_filesystem::path(utf8Path).wstring(), std::move(entry));
+			}
+			return true;
+		}
+
+		// Log the order in which assets are first accessed through get_exp and try_get, see saveAccessProfile
+		void recordAccesses(bool enable = true) {
+			std::lock_guard lock(m_accessMutex);
+			m_accesses.clear();
+			m_recordStart = m_frame;
+			if (enable)
+				m_recordingCount.fetch_add(1, std::memory_order_relaxed); // Assets accessed before are logged again
+			m_recording.store(enable, std::memory_order_relaxed);
+		}
+
+		// Write the recorded accesses as paths and the frame of the first access, counted from recordAccesses
+		bool saveAccessProfile(const std::wstring& file) {
+			std::vector<Access> accesses;
+			{
+				std::lock_guard lock(m_accessMutex);
+				accesses = m_accesses;
+			}
+
+			std::wstring temporary = file + L".tmp";
+			{
+				ofstream out(AssetManager_filesystem::path(temporary), std::ios::binary);
+				if (!out)
+					return false;
+
+				auto write = [&](const auto& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+				write(c_profileMagic);
+				write((uint64_t)accesses.size());
+				for (const auto& access : accesses) {
+					std::u8string path = AssetManager_filesystem::path(access.path).u8string();
+					write((uint32_t)path.size());
+					out.write(reinterpret_cast<const char*>(path.data()), path.size());
+					write((uint32_t)(access.frame - m_recordStart));
+				}
+				if (!out.flush())
+					return false;
+			}
+
+			std::error_code error;
+			AssetManager_filesystem::rename(temporary, file, error);
+			return !error;
+		}
+
+		// Prefetch assets in the order a recorded session first accessed them. Each synchronize starts the loads
+		// the profile expects within the next lookahead frames and moves them to priority, in profile order.
+		bool loadAccessProfile(const std::wstring& file, unsigned lookahead = 2, int priority = 1) {
+			ifstream in(AssetManager_filesystem::path(file), std::ios::binary);
+			if (!in)
+				return false;
+
+			auto read = [&](auto& value) { in.read(reinterpret_cast<char*>(&value), sizeof(value)); };
+
+			uint64_t magic = 0, count = 0;
+			read(magic);
+			read(count);
+			if (!in || magic != c_profileMagic)
+				return false;
+
+			std::vector<Access> profile;
+			std::string path;
+			for (uint64_t i = 0; i < count; ++i) {
+				uint32_t size = 0, frame = 0;
+				read(size);
+				path.resize(in ? size : 0);
+				in.read(path.data(), path.size());
+				read(frame);
+				if (!in)
+					return false;
+				std::u8string_view utf8Path(reinterpret_cast<const char8_t*>(path.data()), path.size());
+				profile.push_back({ AssetManager_filesystem::path(utf8Path).wstring(), frame });
+			}
+
+			m_profile = std::move(profile);
+			m_profileCursor = 0;
+			m_profileStart = m_frame;
+			m_prefetchLookahead = lookahead;
+			m_prefetchPriority = priority;
+			return true;
+		}
+
+	private:
+		using Time = AssetManager_filesystem::file_time_type;
+
+		struct TypeInfo {
+			TypeId		id;
+			const char* name; // Identifies the handler type in the manifest
+		};
+
+		struct ManifestEntry {
+			uint64_t	size = 0;
+			int64_t		writeTime = 0;
+			uint64_t	hash = 0;
+			std::string type{};
+		};
+
+		// Changed file waiting out its settle window
+		struct Settling {
+			Time								  writeTime;
+			std::chrono::steady_clock::time_point since; // When writeTime was first seen
+		};
+
+		// "DKAM" and format version
+		static constexpr uint64_t c_manifestMagic = 0x00000001'4d414b44;
+
+		// "DKAP" and format version
+		static constexpr uint64_t c_profileMagic = 0x00000001'50414b44;
+
+		// First access of an asset while recording, or one loaded from an access profile
+		struct Access {
+			std::wstring path;
+			unsigned	 frame;
+		};
+
+		// A file some assets declared a dependency on
+		struct DependencyNode {
+			std::vector<uint32_t> dependents{}; // Record indices
+			Time				  writeTime{};
+		};
+
+		struct RecordedDependencies {
+			uint32_t				index;
+			uint32_t				generation;
+			std::vector<Dependency> dependencies;
+		};
+
+		struct Callback {
+			uint32_t				   index;
+			uint32_t				   generation;
+			std::function<void(Asset&)> call;
+		};
+
+		// Record initialized or updated by the current synchronize
+		struct Change {
+			uint32_t index;
+			uint32_t generation;
+			bool	 dispatched; // False if the load waits for the records it depends on
+		};
+
+		// Contents of a directory as of writeTime, reused by scans while its write time stays the same
+		struct Listing {
+			Time					  writeTime{};
+			bool					  stable = false;  // Listed over a second after writeTime, so later changes move it
+			std::vector<std::wstring> files{};		   // Not filtered out and with an init handler
+			std::vector<std::wstring> directories{};   // Not excluded
+			mutable unsigned		  scanStamp = 0;   // Scan that last visited it
+		};
+
+		using Listings = std::vector<std::pair<std::wstring, Listing>>;
+
+		// New or changed file with an init handler
+		struct ModifiedFile {
+			std::wstring			path;
+			Time					writeTime;
+			std::optional<uint64_t> hash{}; // Hashed by the scan if tryHandleFile would, see hashContents
+		};
+
+		// Result of a background scan, applied on the synchronizing thread
+		struct ChangeSet {
+			std::vector<ModifiedFile> modified{};
+			std::vector<uint32_t>	  deleted{};  // Record indices
+			Listings				  listings{}; // Directories listed again
+			unsigned				  scanStamp = 0;
+		};
+
+		AssetManager&					m_assetManager;
+		std::wstring					m_path;
+		unsigned						m_syncCount = 0;
+
+		PathToTMap<Handler<Initialize>> m_initHandlers{};
+		PathToTMap<Handler<Update>>	    m_updateHandlers{};
+		PathToTMap<TypeInfo>			m_typeInfos{};
+
+		// Filled by handlers on loader threads, declared before the records whose loads write to it
+		std::mutex						  m_dependencyMutex{};
+		std::vector<RecordedDependencies> m_recordedDependencies{};
+
+		// Mounted in place of the file system, declared before the records whose loads read from it
+		std::unique_ptr<Pack>			  m_pack{};
+
+		// Records never move, erased ones are reused through the free list
+		std::deque<AssetRecord>			m_records{};
+		PathToTMap<uint32_t>			m_index{};
+		std::vector<uint32_t>			m_freeRecords{};
+		std::unordered_map<TypeId, std::vector<uint32_t>> m_typeIndex{}; // Records of each type, for getAll
+
+		std::vector<std::wstring>		m_include{};
+		std::vector<std::wstring>		m_exclude{};
+		PathToTMap<Listing>				m_listings{}; // By directory path
+		unsigned						m_scanCount = 0;
+
+		std::unique_ptr<Watcher>		m_watcher{};
+		bool							m_rescanRequired = true;
+		std::unordered_set<std::wstring> m_retry{}; // Skipped due to an unresolved future, revisited next sync
+
+		PathToTMap<ManifestEntry>		m_manifest{};
+		bool							m_hashContents = false;
+
+		std::atomic<bool>				m_recording = false;
+		unsigned						m_recordStart = 0;
+		std::atomic<unsigned>			m_recordingCount = 0; // Identifies the current recording, see AssetRecord::record
+		std::mutex						m_accessMutex{};
+		std::vector<Access>				m_accesses{};
+
+		std::vector<Access>				m_profile{}; // Frames relative to m_profileStart, prefetched from the cursor on
+		size_t							m_profileCursor = 0;
+		unsigned						m_profileStart = 0;
+		unsigned						m_prefetchLookahead = 0;
+		int								m_prefetchPriority = 0;
+
+		std::chrono::milliseconds		m_settleWindow{ 0 };
+		PathToTMap<Settling>			m_settling{}; // Revisited by every synchronize until settled
+
+		std::atomic<unsigned>			m_frame = 1; // Advanced by every synchronize, read by concurrent gets
+		size_t							m_residentBytes = 0;
+		std::unordered_map<TypeId, size_t> m_residentTypeBytes{};
+
+		PathToTMap<DependencyNode>		m_dependencyNodes{}; // Keyed by normalized path
+		std::vector<Change>				m_changes{};
+
+		std::vector<Callback>			m_callbacks{};
+
+		// Versioned reloads in flight by index and generation, and replaced versions by the frame they were retired in
+		std::vector<std::pair<uint32_t, uint32_t>>					   m_building{};
+		std::vector<std::pair<unsigned, std::shared_ptr<MoveOnlyAny>>> m_retired{};
+
+		// Declared last so an in flight scan is joined before the records it reads are destroyed
+		std::future<ChangeSet>			m_scan{};
+
+	private:
+		template <typename T>
+		std::expected<std::reference_wrapper<T>, AssetReturnStatus> get_exp(AssetRecord& record) {
+			touch(record);
+
+			// Resolve future if unresolved
+			record.asset->tryResolve();
+
+			// Check for type mismatch
+			if (!record.asset->template is_type<T>())
+				return std::unexpected(AssetReturnStatus::TypeMismatch);
+
+			// Handler threw
+			if (!record.asset->has_value())
+				return std::unexpected(AssetReturnStatus::Failed);
+
+			// Return asset
+			return record.asset->template get<T>();
+		}
+
+		template <typename T>
+		std::expected<std::reference_wrapper<T>, AssetReturnStatus> try_get(AssetRecord& record) {
+			// Type is known before the load finishes
+			if (!record.asset->template is_type<T>())
+				return std::unexpected(AssetReturnStatus::TypeMismatch);
+
+			touch(record);
+			if (!record.asset->poll())
+				return std::unexpected(AssetReturnStatus::Pending);
+			if (!record.asset->has_value())
+				return std::unexpected(AssetReturnStatus::Failed);
+
+			return record.asset->template get<T>();
+		}
+
+		void touch(AssetRecord& record) {
+			unsigned frame = m_frame.load(std::memory_order_relaxed);
+			record.touch(frame);
+			if (!m_recording.load(std::memory_order_relaxed) || !record.record(m_recordingCount.load(std::memory_order_relaxed)))
+				return;
+
+			std::lock_guard lock(m_accessMutex);
+			m_accesses.push_back({ record.path, frame });
+		}
+
+		// Start deferred loads first so they run in parallel, then wait on all of them
+		void resolveAll(const std::vector<uint32_t>& indices) {
+			for (uint32_t index : indices)
+				m_records[index].asset->start();
+			for (uint32_t index : indices)
+				m_records[index].asset->tryResolve();
+		}
+
+		void deliverCallbacks() {
+			// Callbacks may register new ones
+			std::vector<Callback> callbacks = std::move(m_callbacks);
+			m_callbacks.clear();
+
+			for (auto& callback : callbacks) {
+				AssetRecord& record = m_records[callback.index];
+				if (record.generation != callback.generation)
+					continue; // Erased
+
+				if (!record.asset->poll()) {
+					m_callbacks.push_back(std::move(callback));
+					continue;
+				}
+
+				// Skip failed loads
+				if (record.asset->has_value())
+					callback.call(*record.asset);
+			}
+		}
+
+		AssetRecord* find(const std::wstring& path) {
+			auto indexIt = m_index.find(path);
+			if (indexIt == m_index.end())
+				return nullptr;
+			return &m_records[indexIt->second];
+		}
+
+		uint32_t create(const std::wstring& path, TypeId type) {
+			uint32_t index;
+			if (!m_freeRecords.empty()) {
+				index = m_freeRecords.back();
+				m_freeRecords.pop_back();
+			}
+			else {
+				index = (uint32_t)m_records.size();
+				m_records.emplace_back();
+			}
+
+			AssetRecord& record = m_records[index];
+			record.path = path;
+			record.asset.emplace(MoveOnlyAny{ type });
+			m_index.emplace(record.path, index);
 
-				return { Base::m_it->first, Base::m_it->second.get<T>() };
-			}
+			auto& slots = m_typeIndex[type];
+			record.type = type;
+			record.typeSlot = (uint32_t)slots.size();
+			slots.push_back(index);
+			return index;
+		}
 
-			iterator& operator++() { 
-				do { ++Base::m_it; } 
-				while (Base::m_it != Base::m_end && !Base::m_it->second.is_type<T>()); 
-				return *this; 
+		void erase(uint32_t index) {
+			AssetRecord& record = m_records[index];
+			m_index.erase(record.path);
+			m_settling.erase(record.path);
+			unlinkDependencies(index);
+
+			// Move the last record of the type into its slot
+			auto& slots = m_typeIndex[record.type];
+			m_records[slots.back()].typeSlot = record.typeSlot;
+			slots[record.typeSlot] = slots.back();
+			slots.pop_back();
+
+			// Asset first, its load might still reference the path
+			record.asset.reset();
+			record.path.clear();
+			record.writeTime = {};
+			record.syncStamp = 0;
+			record.lastAccess = 0;
+			record.recorded = 0;
+			++record.generation; // Invalidates handles
+			m_freeRecords.push_back(index);
+		}
+
+		bool restore(uint32_t index, Time writeTime, Handler<Initialize>& handler, std::optional<uint64_t> hash) {
+			AssetRecord& record = m_records[index];
+			auto entryIt = m_manifest.find(record.path);
+			if (entryIt == m_manifest.end())
+				return false;
+			ManifestEntry entry = std::move(entryIt->second);
+			m_manifest.erase(entryIt);
+
+			// Handler type or size changed
+			std::error_code error;
+			const char* type = m_typeInfos.at(fileExtension(record.path).data()).name;
+			if (entry.type != type || entry.size != AssetManager_filesystem::file_size(record.path, error) || error)
+				return false;
+
+			// Touched, only identical if contents hash the same
+			if (entry.writeTime != writeTime.time_since_epoch().count()
+				&& (!m_hashContents || entry.hash == 0 || entry.hash != (hash ? *hash : contentHash(record.path))))
+				return false;
+
+			record.writeTime = writeTime;
+			record.contentHash = entry.hash;
+			record.asset->defer(handler, record.path.c_str(), m_assetManager.m_scheduler, loadContext(index));
+			return true;
+		}
+
+		// FNV-1a over the file contents
+		static uint64_t contentHash(const std::wstring& path) {
+			ifstream in(AssetManager_filesystem::path(path), std::ios::binary);
+			std::array<char, 64 * 1024> buffer;
+			uint64_t hash = 0xcbf29ce484222325;
+			while (in) {
+				in.read(buffer.data(), buffer.size());
+				for (std::streamsize i = 0; i < in.gcount(); ++i)
+					hash = (hash ^ (uint8_t)buffer[i]) * 0x100000001b3;
 			}
-		};
+			return hash;
+		}
 
-		AssetCollection(PathToTMap<Asset>& assets) : m_assets(assets) { }
+		// Evict least recently used unpinned assets of evictable types not accessed since the last synchronize while over a budget
+		void evictOverBudget() {
+			const auto& typeBudgets = m_assetManager.m_typeBudgets;
+			const auto& evictable = m_assetManager.m_evictable;
+			if ((m_assetManager.m_budget == SIZE_MAX && typeBudgets.empty()) || evictable.empty())
+				return;
 
-		iterator begin() { return iterator(m_assets.begin(), m_assets.end()); }
+			// Recount resolved assets, sizes can change with updates
+			std::vector<std::pair<uint32_t, size_t>> candidates;
+			m_residentBytes = 0;
+			m_residentTypeBytes.clear();
+			for (uint32_t index = 0; index < m_records.size(); ++index) {
+				AssetRecord& record = m_records[index];
+				if (!record.asset || record.asset->busy() || !record.asset->has_value())
+					continue;
 
-		iterator end() { return iterator(m_assets.end(), m_assets.end()); }
-	private:
-		PathToTMap<Asset>& m_assets;
-	};
+				size_t bytes = record.asset->memoryUsage();
+				m_residentBytes += bytes;
+				m_residentTypeBytes[record.asset->type()] += bytes;
+				if (record.lastAccess < m_frame && evictable.contains(record.asset->type()) && !record.asset->pinned())
+					candidates.emplace_back(index, bytes);
+			}
 
-private:
-	class Directory {
-	public:
-		Directory(AssetManager& manager, const wchar_t* path)
-			: m_assetManager(manager)
-			, m_path(path)
-		{ }
+			// Budgets span all directories
+			size_t total = m_assetManager.residentBytes();
+			std::unordered_map<TypeId, size_t> typeTotals;
+			for (const auto& [type, budget] : typeBudgets)
+				typeTotals[type] = m_assetManager.residentBytes(type);
+
+			std::sort(candidates.begin(), candidates.end(), [&](const auto& a, const auto& b) {
+				return m_records[a.first].lastAccess < m_records[b.first].lastAccess;
+			});
+
+			for (const auto& [index, bytes] : candidates) {
+				AssetRecord& record = m_records[index];
+				TypeId type = record.asset->type();
+				auto typeBudgetIt = typeBudgets.find(type);
+				bool overTypeBudget = typeBudgetIt != typeBudgets.end() && typeTotals[type] > typeBudgetIt->second;
+				if (total <= m_assetManager.m_budget && !overTypeBudget)
+					continue;
+
+				record.asset->evict(m_initHandlers.at(fileExtension(record.path).data()), 
+					record.path.c_str(), m_assetManager.m_scheduler, loadContext(index));
+				total -= bytes;
+				if (typeBudgetIt != typeBudgets.end())
+					typeTotals[type] -= bytes;
+				m_residentBytes -= bytes;
+				m_residentTypeBytes[type] -= bytes;
+			}
+		}
 
+		// Records with dependencies are loaded by reloadDependents, after what they depend on
 		template <typename T>
-			requires(std::constructible_from<Initialize, T> && not std::constructible_from<Update, T>)
-		void assing(const wchar_t* extension, T&& function, Execution policy = Execution::Sync) {
-			uintptr_t typeInfo = reinterpret_cast<uintptr_t>(&typeid(std::decay_t<decltype(function(nullptr))>));
-			m_typeInfos.insert({ extension, typeInfo });
-			m_initHandlers.insert({ extension, Handler<Initialize>(std::forward<T&&>(function), policy)});
+		void dispatch(uint32_t index, Handler<T>& handler) {
+			AssetRecord& record = m_records[index];
+			bool ordered = !record.dependencies.empty();
+			m_changes.push_back({ index, record.generation, !ordered });
+			if (!ordered)
+				handle(index, handler);
 		}
 
 		template <typename T>
-			requires(std::constructible_from<Update, T>)
-		void assing(const wchar_t* extension, T&& function, Execution policy = Execution::Sync) {
-			m_updateHandlers.insert({ extension, Handler<Update>(std::forward<T&&>(function), policy)});
+		void handle(uint32_t index, Handler<T>& handler) {
+			AssetRecord& record = m_records[index];
+			record.asset->handle(handler, record.path.c_str(), m_assetManager.m_scheduler, loadContext(index));
+			if (record.asset->building())
+				m_building.push_back({ index, record.generation });
 		}
 
-		template <typename... Ts>
-			requires((std::constructible_from<Initialize, Ts> || std::constructible_from<Update, Ts>) && ...)
-		void assing(Extension<Ts>&&... extensionHandlers) {
-			(assing(extensionHandlers.extension, std::forward<Ts&&>(extensionHandlers.func), extensionHandlers.policy), ...);
+		// Start and raise the loads the access profile expects soon, assets loading anyway are moved ahead of the rest
+		void prefetch() {
+			if (m_profileCursor == m_profile.size() || m_scan.valid())
+				return;
+
+			unsigned horizon = m_frame - m_profileStart + m_prefetchLookahead;
+			for (; m_profileCursor < m_profile.size() && m_profile[m_profileCursor].frame <= horizon; ++m_profileCursor) {
+				AssetRecord* record = find(m_profile[m_profileCursor].path);
+				if (!record)
+					continue;
+				// Other policies would load on this thread, they keep waiting for their first access
+				if (m_initHandlers.at(fileExtension(record->path).data()).policy() == Execution::Async)
+					record->asset->start();
+				record->asset->reprioritize(m_assetManager.m_scheduler, m_prefetchPriority);
+			}
+
+			if (m_profileCursor == m_profile.size())
+				m_profile.clear();
 		}
 
-		template <typename F>
-		Extension<F> ext(const wchar_t* path, F&& func, Execution policy = Execution::Sync) {
-			return m_assetManager.ext(path, std::forward<F&&>(func), policy);
+		// Wait for the load of index and publish it if it was a versioned reload
+		void settle(uint32_t index) {
+			m_records[index].asset->wait();
+			if (auto replaced = m_records[index].asset->publish())
+				m_retired.emplace_back(m_frame, std::move(replaced));
 		}
 
-		template <typename T>
-		std::expected<std::reference_wrapper<T>, AssetReturnStatus> get_exp(const wchar_t* path) {
-			// Find asset or return NotFound
-			auto assetIt = m_assets.find(path);
-			if (assetIt == m_assets.end())
-				return std::unexpected(AssetReturnStatus::NotFound);
+		// Swap in finished versioned reloads, readers may hold the replaced versions until the next synchronize
+		void publishVersions() {
+			std::erase_if(m_retired, [this](const auto& retired) { return retired.first < m_frame; });
 
-			// Resolve future if unresolved
-			assetIt->second.tryResolve();
+			for (size_t i = 0; i < m_building.size(); ) {
+				auto [index, generation] = m_building[i];
+				Asset* asset = m_records[index].generation == generation ? &*m_records[index].asset : nullptr;
+				if (asset) {
+					if (auto replaced = asset->publish())
+						m_retired.emplace_back(m_frame, std::move(replaced));
+				}
 
-			// Check for type mismatch
-			if (!assetIt->second.is_type<T>())
-				return std::unexpected(AssetReturnStatus::TypeMismatch);
+				// Keep reloads still in flight
+				if (asset && asset->building()) {
+					++i;
+					continue;
+				}
+				m_building[i] = m_building.back();
+				m_building.pop_back();
+			}
+		}
 
-			// Return asset
-			return assetIt->second.get<T>();
+		LoadContext loadContext(uint32_t index) {
+			auto sink = [this, index, generation = m_records[index].generation](std::vector<Dependency>&& dependencies) {
+				std::lock_guard lock(m_dependencyMutex);
+				m_recordedDependencies.push_back({ index, generation, std::move(dependencies) });
+			};
+			return { sink, m_pack.get(), &m_assetManager.m_uploads, m_assetManager.m_cache.get() };
 		}
 
-		template <typename T>
-		T& get(const wchar_t* path) {
-			return get_exp<T>(path).value();
+		// Replace the edges of records whose loads finished since the last synchronize
+		void harvestDependencies() {
+			std::vector<RecordedDependencies> recorded;
+			{
+				std::lock_guard lock(m_dependencyMutex);
+				recorded.swap(m_recordedDependencies);
+			}
+
+			if (recorded.empty())
+				return;
+
+			// Nodes outlive relinking, a change they haven't seen yet still reloads their dependents
+			for (auto& [index, generation, dependencies] : recorded) {
+				AssetRecord& record = m_records[index];
+				if (record.generation != generation)
+					continue; // Erased since
+
+				unlinkDependencies(index, false);
+				for (const auto& dependency : dependencies) {
+					std::wstring normalized = normalize(dependency.path);
+					if (std::find(record.dependencies.begin(), record.dependencies.end(), normalized) != record.dependencies.end())
+						continue;
+
+					// New nodes start at the version the load saw, not the one on disk now
+					auto [nodeIt, inserted] = m_dependencyNodes.try_emplace(normalized);
+					if (inserted)
+						nodeIt->second.writeTime = dependency.writeTime;
+					nodeIt->second.dependents.push_back(index);
+					record.dependencies.push_back(std::move(normalized));
+				}
+			}
+			std::erase_if(m_dependencyNodes, [](const auto& node) { return node.second.dependents.empty(); });
 		}
 
-		// TODO: getAll<T>()
-		template <typename T>
-		AssetCollection<T> getAll() { return AssetCollection<T>(m_assets); }
+		// eraseUnused: drop nodes left without dependents, otherwise the caller does once it relinked
+		void unlinkDependencies(uint32_t index, bool eraseUnused = true) {
+			AssetRecord& record = m_records[index];
+			for (const auto& path : record.dependencies) {
+				auto nodeIt = m_dependencyNodes.find(path);
+				auto& dependents = nodeIt->second.dependents;
+				dependents.erase(std::find(dependents.begin(), dependents.end(), index));
+				if (eraseUnused && dependents.empty())
+					m_dependencyNodes.erase(nodeIt);
+			}
+			record.dependencies.clear();
+		}
+
+		// Reload everything downstream of changed files level by level, a level's loads run in parallel.
+		// Each record is loaded at most once per pass, records on a cycle are loaded together last.
+		unsigned reloadDependents(bool checkFiles) {
+			harvestDependencies();
+			std::vector<Change> changes = std::move(m_changes);
+			m_changes.clear();
+			if (m_dependencyNodes.empty())
+				return 0;
+
+			std::unordered_set<uint32_t> dispatched, reloading;
+			std::vector<uint32_t> frontier;
+			for (const auto& change : changes) {
+				if (m_records[change.index].generation != change.generation)
+					continue;
+				(change.dispatched ? dispatched : reloading).insert(change.index);
+				frontier.push_back(change.index);
+			}
+			std::unordered_set<uint32_t> changed = reloading; // Already counted by tryHandleFile
+
+			auto addDependents = [&](const DependencyNode& node) {
+				for (uint32_t dependent : node.dependents)
+					if (!dispatched.contains(dependent) && reloading.insert(dependent).second)
+						frontier.push_back(dependent);
+			};
+
+			// Changed dependency files. Assets whose change tryHandleFile took, or left to settle or retry,
+			// are skipped. Others, like assets without an update handler, are checked as plain files.
+			if (checkFiles) {
+				for (auto& [path, node] : m_dependencyNodes) {
+					Time writeTime = lastWriteTime(path);
+					if (writeTime == node.writeTime)
+						continue;
+					if (auto indexIt = m_index.find(path); indexIt != m_index.end()) {
+						const AssetRecord& record = m_records[indexIt->second];
+						if (record.writeTime == writeTime) {
+							node.writeTime = writeTime;
+							continue;
+						}
+						if (m_settling.contains(record.path) || m_retry.contains(record.path))
+							continue;
+					}
+					node.writeTime = writeTime;
+					addDependents(node);
+				}
+			}
+
+			// Close over dependents of everything reloading
+			while (!frontier.empty()) {
+				uint32_t index = frontier.back();
+				frontier.pop_back();
+				if (auto nodeIt = m_dependencyNodes.find(normalize(m_records[index].path)); nodeIt != m_dependencyNodes.end())
+					addDependents(nodeIt->second);
+			}
+			if (reloading.empty())
+				return 0;
+
+			// Count dependencies reloading in this pass, records without any form the first level
+			PathToTMap<uint32_t> reloadingPaths;
+			for (uint32_t index : reloading)
+				reloadingPaths.emplace(normalize(m_records[index].path), index);
+
+			std::unordered_map<uint32_t, unsigned> pending;
+			std::vector<uint32_t> level;
+			for (uint32_t index : reloading) {
+				unsigned count = 0;
+				for (const auto& dependency : m_records[index].dependencies)
+					count += reloadingPaths.contains(dependency);
+				pending.emplace(index, count);
+				if (count == 0)
+					level.push_back(index);
+			}
+
+			// Dependents read what the already dispatched loads they depend on produce, others keep loading
+			std::unordered_set<std::wstring> dependencies;
+			for (uint32_t index : reloading)
+				dependencies.insert(m_records[index].dependencies.begin(), m_records[index].dependencies.end());
+			for (uint32_t index : dispatched)
+				if (dependencies.contains(normalize(m_records[index].path)))
+					settle(index);
+
+			unsigned reloadCount = 0;
+			while (!pending.empty()) {
+				if (level.empty()) {
+					// Only cycles left
+					for (const auto& [index, count] : pending)
+						level.push_back(index);
+				}
+
+				for (uint32_t index : level) {
+					pending.erase(index);
+					if (reload(index) && !changed.contains(index))
+						++reloadCount;
+				}
+				for (uint32_t index : level)
+					settle(index);
+
+				std::vector<uint32_t> next;
+				for (uint32_t index : level) {
+					auto nodeIt = m_dependencyNodes.find(normalize(m_records[index].path));
+					if (nodeIt == m_dependencyNodes.end())
+						continue;
+					for (uint32_t dependent : nodeIt->second.dependents) {
+						auto pendingIt = pending.find(dependent);
+						if (pendingIt != pending.end() && --pendingIt->second == 0)
+							next.push_back(dependent);
+					}
+				}
+				level = std::move(next);
+			}
+			return reloadCount;
+		}
+
+		bool reload(uint32_t index) {
+			Asset& asset = *m_records[index].asset;
+			const std::wstring& path = m_records[index].path;
+
+			// Loads on first access anyway
+			if (asset.deferred())
+				return false;
+
+			// Storage can't have two loads in flight
+			if (asset.busy() && !asset.cancel())
+				settle(index);
+
+			auto ext = fileExtension(path);
+			auto& initHandler = m_initHandlers.at(ext.data());
+			auto updateHandlerIt = m_updateHandlers.find(ext.data());
+			if (asset.has_value() && updateHandlerIt != m_updateHandlers.end() && !initHandler.options().versioned)
+				handle(index, updateHandlerIt->second);
+			else
+				handle(index, initHandler);
+			return true;
+		}
+
+		static std::wstring normalize(const std::wstring& path) {
+			return AssetManager_filesystem::path(path).lexically_normal().wstring();
+		}
+
+		static Time lastWriteTime(const std::wstring& path) {
+			std::error_code error;
+			Time writeTime = AssetManager_filesystem::last_write_time(path, error);
+			return error ? Time::min() : writeTime;
+		}
+
+		unsigned rescan(SyncMode mode) {
+			if (mode == SyncMode::Background)
+				return synchronizeBackground();
+
+			// Drop in flight background scan, a full walk follows anyway
+			waitForScan();
+			discardWatcherEvents();
 
-		unsigned synchronize() {
-			namespace fs = AssetManager_filesystem;
 			++m_syncCount;
+			unsigned scanStamp = ++m_scanCount;
 			unsigned synchronizedCount = 0;
 
-			// Iterate over files and init or update assets with matching handlers
-			for (const auto& filePath : fs::recursive_directory_iterator(m_path)) {
-				if (!fs::is_regular_file(filePath.path()))
-					continue;
+			// Walk the listings and init or update assets with matching handlers.
+			// Handled files get their sync stamp set to the current sync count (used to find deleted files).
+			Listings listings;
+			std::vector<std::wstring> directories{ m_path };
+			while (!directories.empty()) {
+				std::wstring directory = std::move(directories.back());
+				directories.pop_back();
+
+				const Listing& listing = list(directory, scanStamp, listings);
+				directories.insert(directories.end(), listing.directories.begin(), listing.directories.end());
+				for (const auto& file : listing.files) {
+					// Removed since it was listed
+					Time writeTime = lastWriteTime(file);
+					if (writeTime == Time::min())
+						continue;
+
+					if (tryHandleFile(file, writeTime))
+						++synchronizedCount;
+				}
+			}
+			storeListings(std::move(listings), scanStamp);
 
-				// Set sync stamp of asset to current sync count (used to find deleted files)
-				auto assetStampIt = m_assetSyncStamps.find(filePath.path().wstring());
-				if (assetStampIt != m_assetSyncStamps.end())
-					assetStampIt->second = m_syncCount;
+			// Handle deleted files
+			for (uint32_t index = 0; index < m_records.size(); ++index)
+				if (m_records[index].asset && m_records[index].syncStamp != m_syncCount)
+					erase(index);
 
-				Time lastWriteTime = fs::last_write_time(filePath.path());
-				if (tryHandleFile(filePath.path().wstring(), lastWriteTime)) {
-					// Asset initialized or updated successfully
-					++synchronizedCount;
+			m_rescanRequired = false;
+			m_manifest.clear();
+			return synchronizedCount;
+		}
+
+		// Packs are immutable, only the first synchronize after mounting visits their entries
+		unsigned synchronizePack() {
+			if (!m_rescanRequired)
+				return 0;
+
+			waitForScan();
+			++m_syncCount;
+			unsigned synchronizedCount = 0;
+			for (const auto& entry : m_pack->entries()) {
+				std::string_view relative = m_pack->path(entry);
+				std::wstring path = (AssetManager_filesystem::path(m_path) 
+					/ std::u8string_view(reinterpret_cast<const char8_t*>(relative.data()), relative.size())).make_preferred().wstring();
+				if (filtered(path, true))
 					continue;
-				}
-				continue;
+				if (tryHandleFile(path, Time(Time::duration(entry.writeTime))))
+					++synchronizedCount;
 			}
 
-			// Handle deleted files
-			auto assetIt = m_assets.begin();
-			while (assetIt != m_assets.end()) {
-				if (m_assetSyncStamps.at(assetIt->first) == m_syncCount) {
-					++assetIt;
-					continue; // Not delted
+			// Assets loaded from the file system before mounting but not packed
+			for (uint32_t index = 0; index < m_records.size(); ++index)
+				if (m_records[index].asset && m_records[index].syncStamp != m_syncCount)
+					erase(index);
+
+			m_rescanRequired = false;
+			m_manifest.clear();
+			return synchronizedCount;
+		}
+
+		unsigned synchronizeWatched(SyncMode mode) {
+			namespace fs = AssetManager_filesystem;
+
+			// Fall back to a full rescan if events were lost
+			std::vector<std::wstring> changed;
+			if (!m_watcher->poll(changed)) {
+				m_rescanRequired = true;
+				return rescan(mode);
+			}
+
+			// Visit touched paths and the ones skipped last time once each
+			std::unordered_set<std::wstring> touched = std::move(m_retry);
+			m_retry.clear();
+			touched.insert(std::make_move_iterator(changed.begin()), std::make_move_iterator(changed.end()));
+			for (const auto& [path, settling] : m_settling)
+				touched.insert(path);
+
+			// Paths may disappear again before they are visited, their removal is reported by a later poll
+			unsigned synchronizedCount = 0;
+			std::error_code error;
+			for (const auto& path : touched) {
+				if (fs::is_regular_file(path, error)) {
+					Time writeTime = lastWriteTime(path);
+					if (writeTime != Time::min() && !filtered(path, true) && tryHandleFile(path, writeTime))
+						++synchronizedCount;
 				}
+				else if (fs::is_directory(path, error)) {
+					// Created or moved in, files inside have no events of their own
+					if (excluded(path, true))
+						continue;
+					for (fs::recursive_directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+						std::wstring filePath = it->path().wstring();
+						if (!it->is_regular_file(error) || filtered(filePath, true))
+							continue;
+						Time writeTime = lastWriteTime(filePath);
+						if (writeTime != Time::min() && tryHandleFile(filePath, writeTime))
+							++synchronizedCount;
+					}
+				}
+				else
+					eraseTree(path); // Removed or moved out
+			}
+
+			return synchronizedCount;
+		}
+
+		void discardWatcherEvents() {
+			if (!m_watcher)
+				return;
+			// A full rescan covers everything queued so far
+			std::vector<std::wstring> ignored;
+			m_watcher->poll(ignored);
+		}
 
-				// Remove asset
-				m_assetWriteTime.erase(assetIt->first);
-				m_assetSyncStamps.erase(assetIt->first);
-				assetIt = m_assets.erase(assetIt);
+		// Erase the asset at path or every asset below it if path was a directory
+		void eraseTree(const std::wstring& path) {
+			auto indexIt = m_index.find(path);
+			if (indexIt != m_index.end())
+				return erase(indexIt->second);
+
+			std::wstring prefix = path + static_cast<wchar_t>(AssetManager_filesystem::path::preferred_separator);
+			for (uint32_t index = 0; index < m_records.size(); ++index)
+				if (m_records[index].asset && m_records[index].path.starts_with(prefix))
+					erase(index);
+		}
+
+		unsigned synchronizeBackground() {
+			// Start scan if none is in flight
+			if (!m_scan.valid()) {
+				discardWatcherEvents();
+				m_scan = std::async(std::launch::async, [this, scanStamp = ++m_scanCount] { return scan(scanStamp); });
+				return 0;
 			}
 
+			// Return if scan hasn't finished yet
+			if (m_scan.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
+				return 0;
+
+			// Init or update changed assets
+			ChangeSet changes = m_scan.get();
+			unsigned synchronizedCount = 0;
+			for (const auto& [path, writeTime, hash] : changes.modified)
+				if (tryHandleFile(path, writeTime, hash))
+					++synchronizedCount;
+
+			// Remove deleted assets
+			for (uint32_t index : changes.deleted)
+				erase(index);
+			storeListings(std::move(changes.listings), changes.scanStamp);
+
+			m_rescanRequired = false;
+			m_manifest.clear();
 			return synchronizedCount;
 		}
 
-	private:
-		using Time = AssetManager_filesystem::file_time_type;
+		void waitForScan() {
+			if (!m_scan.valid())
+				return;
+			m_scan.wait();
+			m_scan = {};
+		}
 
-		AssetManager&					m_assetManager;
-		std::wstring					m_path;
-		unsigned						m_syncCount = 0;
+		// Runs on worker threads. Only reads handlers, asset records and settling files,
+		// which are not modified while a scan is in flight.
+		ChangeSet scan(unsigned scanStamp) const {
+			namespace fs = AssetManager_filesystem;
 
-		PathToTMap<Handler<Initialize>> m_initHandlers{};
-		PathToTMap<Handler<Update>>	    m_updateHandlers{};
-		PathToTMap<uintptr_t>			m_typeInfos{};
+			struct Shared {
+				std::mutex				mut;
+				std::condition_variable cv;
+				std::vector<fs::path>	directories;
+				unsigned				busy = 0;
+				std::exception_ptr		exception = nullptr;
+			} shared;
+			shared.directories.emplace_back(m_path);
+
+			struct Local {
+				std::vector<ModifiedFile> modified;
+				std::vector<uint32_t>	  present; // Records seen during scan
+				Listings				  listings;
+			};
+
+			// Hash contents here rather than on the synchronizing thread, unless the manifest restores the file unchanged
+			auto hash = [&](const std::wstring& path, Time writeTime) -> std::optional<uint64_t> {
+				auto entryIt = m_manifest.find(path);
+				if (!m_hashContents || (entryIt != m_manifest.end() && entryIt->second.writeTime == writeTime.time_since_epoch().count()))
+					return std::nullopt;
+				return contentHash(path);
+			};
+
+			// Each worker pops a directory, handles its files and pushes its subdirectories
+			auto walk = [&](Local& local) {
+				std::vector<fs::path> subdirectories;
+				while (true) {
+					fs::path directory;
+					{
+						std::unique_lock lock(shared.mut);
+						shared.cv.wait(lock, [&] { return !shared.directories.empty() || shared.busy == 0; });
+						if (shared.directories.empty())
+							return; // Nothing queued and nothing being walked
+						directory = std::move(shared.directories.back());
+						shared.directories.pop_back();
+						++shared.busy;
+					}
+
+					try {
+						const Listing& listing = list(directory.wstring(), scanStamp, local.listings);
+						subdirectories.insert(subdirectories.end(), listing.directories.begin(), listing.directories.end());
+						for (const auto& path : listing.files) {
+							// Removed since it was listed
+							Time writeTime = lastWriteTime(path);
+							if (writeTime == Time::min())
+								continue;
+
+							auto indexIt = m_index.find(path);
+							if (indexIt == m_index.end()) {
+								local.modified.push_back({ path, writeTime, hash(path, writeTime) });
+								continue;
+							}
+
+							// Settling files are reported even if they went back to their loaded write time
+							local.present.push_back(indexIt->second);
+							if (m_records[indexIt->second].writeTime != writeTime || (!m_settling.empty() && m_settling.contains(path)))
+								local.modified.push_back({ path, writeTime, hash(path, writeTime) });
+						}
+					}
+					catch (...) {
+						std::lock_guard lock(shared.mut);
+						if (!shared.exception)
+							shared.exception = std::current_exception();
+					}
+
+					std::lock_guard lock(shared.mut);
+					for (auto& subdirectory : subdirectories)
+						shared.directories.push_back(std::move(subdirectory));
+					subdirectories.clear();
+					--shared.busy;
+					shared.cv.notify_all();
+				}
+			};
+
+			// Walk on worker threads, the current thread being one of them
+			unsigned workerCount = std::max(1u, std::thread::hardware_concurrency());
+			std::vector<Local> locals(workerCount);
+			std::vector<std::future<void>> workers;
+			for (unsigned i = 1; i < workerCount; ++i)
+				workers.push_back(std::async(std::launch::async, walk, std::ref(locals[i])));
+			walk(locals[0]);
+			for (auto& worker : workers)
+				worker.wait();
+
+			if (shared.exception)
+				std::rethrow_exception(shared.exception);
+
+			// Merge worker results
+			ChangeSet changes;
+			changes.scanStamp = scanStamp;
+			size_t presentCount = 0;
+			for (auto& local : locals) {
+				presentCount += local.present.size();
+				std::move(local.modified.begin(), local.modified.end(), std::back_inserter(changes.modified));
+				std::move(local.listings.begin(), local.listings.end(), std::back_inserter(changes.listings));
+			}
 
-		PathToTMap<Asset>				m_assets{};
-		PathToTMap<Time>				m_assetWriteTime{};
-		PathToTMap<unsigned>			m_assetSyncStamps{};
+			// Assets not seen during the walk were deleted
+			if (presentCount != m_index.size()) {
+				std::vector<bool> present(m_records.size());
+				for (const auto& local : locals)
+					for (uint32_t index : local.present)
+						present[index] = true;
+				for (uint32_t index = 0; index < m_records.size(); ++index)
+					if (m_records[index].asset && !present[index])
+						changes.deleted.push_back(index);
+			}
 
-	private:
-		bool tryHandleFile(const std::wstring& path, Time writeTime) {
+			return changes;
+		}
+
+		// Files with an init handler and subdirectories of directory, reused from an earlier scan while the directory's
+		// write time is unchanged. Files changed in place don't touch it, the caller still checks their write times.
+		// Directories listed again are appended to listings, the returned reference is valid until the next call.
+		const Listing& list(const std::wstring& directory, unsigned scanStamp, Listings& listings) const {
+			Time writeTime = lastWriteTime(directory);
+			auto listingIt = m_listings.find(directory);
+			if (listingIt != m_listings.end() && listingIt->second.stable && listingIt->second.writeTime == writeTime) {
+				listingIt->second.scanStamp = scanStamp;
+				return listingIt->second;
+			}
+
+			// A change within the same timestamp tick as listing wouldn't move the write time
+			Listing listing{ writeTime, writeTime != Time::min() && Time::clock::now() - writeTime > std::chrono::seconds(1) };
+			listing.scanStamp = scanStamp;
+			for (const auto& entry : AssetManager_filesystem::directory_iterator(directory)) {
+				std::wstring path = entry.path().wstring();
+				if (entry.is_directory()) {
+					if (!excluded(path))
+						listing.directories.push_back(std::move(path));
+				}
+				else if (entry.is_regular_file() && m_initHandlers.contains(fileExtension(path).data()) && !filtered(path))
+					listing.files.push_back(std::move(path));
+			}
+			return listings.emplace_back(directory, std::move(listing)).second;
+		}
+
+		// Keep the listings visited by the scan, replacing the ones it listed again
+		void storeListings(Listings&& listings, unsigned scanStamp) {
+			for (auto& [directory, listing] : listings)
+				m_listings.insert_or_assign(std::move(directory), std::move(listing));
+			std::erase_if(m_listings, [scanStamp](const auto& listing) { return listing.second.scanStamp != scanStamp; });
+		}
+
+		// Path matches an exclude glob. Walks only reach paths below directories already checked,
+		// paths from elsewhere check every directory above them too.
+		bool excluded(const std::wstring& path, bool ancestors = false) const {
+			if (m_exclude.empty())
+				return false;
+
+			std::wstring relative = relativePath(path);
+			auto matches = [this](std::wstring_view relative) {
+				return std::any_of(m_exclude.begin(), m_exclude.end(), [&](const auto& glob) { return matchGlob(glob, relative); });
+			};
+			if (matches(relative))
+				return true;
+			for (size_t separator = relative.find(L'/'); ancestors && separator != std::wstring::npos; separator = relative.find(L'/', separator + 1))
+				if (matches(std::wstring_view(relative).substr(0, separator)))
+					return true;
+			return false;
+		}
+
+		// File excluded or not matching any include glob
+		bool filtered(const std::wstring& file, bool ancestors = false) const {
+			if (excluded(file, ancestors))
+				return true;
+			if (m_include.empty())
+				return false;
+			std::wstring relative = relativePath(file);
+			return std::none_of(m_include.begin(), m_include.end(), [&](const auto& glob) { return matchGlob(glob, relative); });
+		}
+
+		// Relative to the directory with '/' separators, as globs are written
+		std::wstring relativePath(const std::wstring& path) const {
+			std::wstring relative = path.substr(std::min(path.size(), m_path.size() + 1));
+			if constexpr (AssetManager_filesystem::path::preferred_separator != L'/')
+				std::replace(relative.begin(), relative.end(), static_cast<wchar_t>(AssetManager_filesystem::path::preferred_separator), L'/');
+			return relative;
+		}
+
+		static bool matchGlob(std::wstring_view glob, std::wstring_view path) {
+			if (glob.empty())
+				return path.empty();
+
+			if (glob.starts_with(L"**")) {
+				glob.remove_prefix(2);
+				// "**/" matches no directory as well
+				if (glob.starts_with(L'/') && matchGlob(glob.substr(1), path))
+					return true;
+				for (size_t i = 0; i <= path.size(); ++i)
+					if (matchGlob(glob, path.substr(i)))
+						return true;
+				return false;
+			}
+
+			if (glob[0] == L'*') {
+				for (size_t i = 0; i <= path.size(); ++i) {
+					if (matchGlob(glob.substr(1), path.substr(i)))
+						return true;
+					if (i < path.size() && path[i] == L'/')
+						break;
+				}
+				return false;
+			}
+
+			if (path.empty() || (glob[0] == L'?' ? path[0] == L'/' : glob[0] != path[0]))
+				return false;
+			return matchGlob(glob.substr(1), path.substr(1));
+		}
+
+		// True once path kept writeTime for window, a different write time restarts the window
+		bool settled(const std::wstring& path, Time writeTime, std::chrono::milliseconds window) {
+			if (window <= std::chrono::milliseconds(0))
+				return true;
+
+			auto now = std::chrono::steady_clock::now();
+			auto [settlingIt, inserted] = m_settling.try_emplace(path, Settling{ writeTime, now });
+			if (!inserted && settlingIt->second.writeTime != writeTime)
+				settlingIt->second = { writeTime, now };
+			if (now - settlingIt->second.since < window)
+				return false;
+
+			m_settling.erase(settlingIt);
+			return true;
+		}
+
+		// hash is the content hash if the caller computed it already
+		bool tryHandleFile(const std::wstring& path, Time writeTime, std::optional<uint64_t> hash = std::nullopt) {
 			auto ext = fileExtension(path);
 			// Return if extension doesn't have init handler
 			auto initHandlerIt = m_initHandlers.find(ext.data());
 			if (initHandlerIt == m_initHandlers.end())
 				return false;
 
-			// Find or create asset storage
-			auto assetIt = m_assets.find(path);
-			if (assetIt == m_assets.end()) {
-				uintptr_t type = m_typeInfos.at(ext.data());
-				assetIt = m_assets.emplace(path, MoveOnlyAny{ type }).first;
+			// Find or create asset record
+			uint32_t index;
+			auto indexIt = m_index.find(path);
+			if (indexIt == m_index.end()) {
+				index = create(path, m_typeInfos.at(ext.data()).id);
+				m_records[index].syncStamp = m_syncCount;
+
+				// Unchanged since the manifest was saved, load on first access
+				if (restore(index, writeTime, initHandlerIt->second, hash))
+					return false;
+			}
+			else {
+				index = indexIt->second;
+				m_records[index].syncStamp = m_syncCount;
+
+				// Wait for writes in progress to finish before reloading, a file back at its loaded write time stops waiting
+				std::chrono::milliseconds window = std::max(m_settleWindow, initHandlerIt->second.options().settleWindow);
+				if (m_records[index].writeTime == writeTime) {
+					if (!m_settling.empty())
+						m_settling.erase(path);
+				}
+				else if (!settled(path, writeTime, window))
+					return false;
 			}
+			AssetRecord* record = &m_records[index];
+			Asset& asset = *record->asset;
 
-			// Asset has unresolved future
-			if (assetIt->second.unresolved())
-				return false;
+			if (asset.busy()) {
+				// Pending load already sees the current file
+				if (record->writeTime == writeTime)
+					return false;
+
+				// Supersede load if it's still queued, otherwise the watcher won't report the file again
+				if (!asset.cancel()) {
+					if (m_watcher)
+						m_retry.insert(path);
+					return false;
+				}
+			}
 
-			// Get path string with extended lifetime
-			const auto& storedPath = assetIt->first;
+			if (!asset.has_value()) {
+				// Restored from manifest and still unchanged
+				if (asset.deferred() && record->writeTime == writeTime)
+					return false;
 
-			if (!assetIt->second.has_value()) {
 				// Initialize asset and set write time
-				m_assetWriteTime[storedPath] = writeTime;
-				m_assetSyncStamps[storedPath] = m_syncCount;
-				assetIt->second.handle(initHandlerIt->second, storedPath.c_str());
+				record->writeTime = writeTime;
+				record->contentHash = m_hashContents ? (hash ? *hash : contentHash(path)) : 0;
+				dispatch(index, initHandlerIt->second);
 				return true;
 			}
 			else {
 				// Return if update times match
-				auto writeTimeIt = m_assetWriteTime.find(path);
-				if (writeTimeIt == m_assetWriteTime.end() || writeTimeIt->second == writeTime)
+				if (record->writeTime == writeTime)
 					return false;
 
-				// Find update handler and return if it doesn't exists
+				// Find update handler and return if it doesn't exists, versioned assets rebuild with the init handler
 				auto updateHandlerIt = m_updateHandlers.find(ext.data());
-				if (updateHandlerIt == m_updateHandlers.end())
+				bool versioned = initHandlerIt->second.options().versioned;
+				if (updateHandlerIt == m_updateHandlers.end() && !versioned)
 					return false;
 
+				// Touched but identical content, nothing to reload
+				if (m_hashContents) {
+					uint64_t contents = hash ? *hash : contentHash(path);
+					bool identical = contents == record->contentHash;
+					record->contentHash = contents;
+					record->writeTime = writeTime;
+					if (identical)
+						return false;
+				}
+
 				// Update asset and write time
-				m_assetWriteTime[storedPath] = writeTime;
-				assetIt->second.handle(updateHandlerIt->second, storedPath.c_str());
+				record->writeTime = writeTime;
+				if (versioned)
+					dispatch(index, initHandlerIt->second);
+				else
+					dispatch(index, updateHandlerIt->second);
 				return true;
 			}
 		}
 	};
 
 public:
+	AssetManager() = default;
+
+	AssetManager(LoadScheduler::Properties schedulerProperties)
+		: m_scheduler(schedulerProperties)
+	{ }
+
 	template <typename... Fs>
 		requires((std::constructible_from<Initialize, Fs> || std::constructible_from<Update, Fs>) && ...)
 	Directory& directory(std::wstring&& path, Extension<Fs>&&... extensionHandlers) {
@@ -467,24 +2906,192 @@ public:
 		if (it != m_directories.end())
 			dir = &it->second;
 		else
-			dir = &m_directories.insert({ std::move(path), { *this, path.c_str() }}).first->second;
+			dir = &m_directories.try_emplace(path, *this, path.c_str()).first->second;
 
 		// Assign handlers and return
 		dir->assing(std::forward<Extension<Fs>&&>(extensionHandlers)...);
 		return *dir;
 	}
 
+	// Directory served from packFile, see Directory::mount
+	template <typename... Fs>
+		requires((std::constructible_from<Initialize, Fs> || std::constructible_from<Update, Fs>) && ...)
+	Directory& mount(std::wstring&& path, const wchar_t* packFile, Extension<Fs>&&... extensionHandlers) {
+		Directory& dir = directory(std::move(path), std::forward<Extension<Fs>&&>(extensionHandlers)...);
+		if (!dir.mount(packFile))
+			throw std::runtime_error("Failed to open asset pack");
+		return dir;
+	}
+
 	// Create: T(const wchar_t*)
 	// Update: void(T&,const wchar_t*) or void T::(const wchar_t*)
 	template <typename F>
-	Extension<F> ext(const wchar_t* path, F&& func, Execution policy = Execution::Sync) {
-		return Extension<F>{ path, std::forward<F&&>(func), policy };
+	Extension<F> ext(const wchar_t* path, F&& func, Execution policy = Execution::Sync, LoadOptions options = {}) {
+		return Extension<F>{ path, std::forward<F&&>(func), policy, options };
+	}
+
+	// Handler for ext split in two phases. Decode runs according to the policy, upload on the thread calling
+	// upload, so Async handlers can decode on workers and make GL calls on the GL thread. Blocking gets and
+	// synchronizes on other threads wait for that thread's next upload call, so handlers must not block on
+	// staged assets while the upload thread waits for them.
+	// Decode: D(const wchar_t*) or D(const FileView&)
+	// Upload, create: T(D&&), update: void T::(D&&)
+	template <typename Decode, typename Upload>
+	static Staged<std::decay_t<Decode>, std::decay_t<Upload>> staged(Decode&& decode, Upload&& upload) {
+		return { std::forward<Decode>(decode), std::forward<Upload>(upload) };
+	}
+
+	// Run upload phases of staged handlers on the calling thread, call once per frame on the GL thread.
+	// Stops once either budget is spent, but runs at least one upload. Returns the number of uploads run.
+	// The calling thread becomes the upload thread, until the first call the thread creating the manager is.
+	// Blocking gets on it run the upload of the asset they wait for right away, gets on other threads wait for it.
+	unsigned upload(UploadBudget budget) {
+		m_uploads.thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+		auto start = std::chrono::steady_clock::now();
+		unsigned uploadCount = 0;
+		size_t bytes = 0;
+		while (true) {
+			std::shared_ptr<UploadTask> task;
+			{
+				std::lock_guard lock(m_uploads.mut);
+				if (m_uploads.tasks.empty())
+					break;
+				task = m_uploads.tasks.front();
+				if (uploadCount > 0 && task->bytes > budget.bytes - std::min(bytes, budget.bytes))
+					break;
+				m_uploads.tasks.pop_front();
+			}
+
+			// Skip uploads cancelled or already run by a blocking get
+			if (!task->run())
+				continue;
+			++uploadCount;
+			bytes += task->bytes;
+			if (std::chrono::steady_clock::now() - start >= budget.time)
+				break;
+		}
+		return uploadCount;
+	}
+
+	unsigned upload() {
+		return upload(UploadBudget{});
+	}
+
+	// Upload phases waiting for upload
+	size_t pendingUploads() {
+		std::lock_guard lock(m_uploads.mut);
+		return std::count_if(m_uploads.tasks.begin(), m_uploads.tasks.end(), [](const auto& task) { return !task->claimed; });
+	}
+
+	// Call from an init or update handler. The asset being loaded is reloaded by synchronize whenever path
+	// changes, after the assets it depends on. Ignored outside of handlers.
+	static void dependsOn(const wchar_t* path) {
+		if (!s_dependencies)
+			return;
+		std::error_code error;
+		auto writeTime = AssetManager_filesystem::last_write_time(path, error);
+		s_dependencies->push_back({ path, error ? AssetManager_filesystem::file_time_type::min() : writeTime });
+	}
+
+	// Map the file at path, or view it in the pack of the directory whose handler is running on this thread.
+	// Returns nullptr if it can't be opened.
+	static std::unique_ptr<FileView> openFile(const wchar_t* path) {
+		if (s_pack)
+			return s_pack->view(path);
+		return FileView::map(path);
+	}
+
+	// Keep outputs of handlers calling derived in directory, shared with other processes using it.
+	// Call before the first synchronize.
+	void derivedDataCache(std::wstring directory, uint64_t maxBytes) {
+		m_cache = std::make_unique<DerivedDataCache>(std::move(directory), maxBytes);
+	}
+
+	// Call from an init handler. Returns the output cached for key, or runs compute, which serializes the output,
+	// and caches it. compute runs every time without a cache.
+	static std::unique_ptr<FileView> derived(const DerivedDataCache::Key& key, const std::function<std::vector<std::byte>()>& compute) {
+		return derive(key, compute, false);
+	}
+
+	// Call from an init handler. Like derived for an array of trivially copyable T, but the array is read in place
+	// from the cache entry, so processes loading key share its pages. The first one computes it, the others wait
+	// for it and map it. Point the cache at a RAM backed directory to keep it off disk.
+	template <typename T, typename F>
+		requires(std::is_trivially_copyable_v<T> && std::is_invocable_r_v<std::vector<T>, F>)
+	static SharedArray<T> shared(const DerivedDataCache::Key& key, F&& compute) {
+		static_assert(alignof(T) <= alignof(std::max_align_t), "Entries are only aligned for fundamental types");
+		return SharedArray<T>(derive(key, [&] {
+			std::vector<T> items = compute();
+			auto bytes = std::as_bytes(std::span(items));
+			return std::vector<std::byte>(bytes.begin(), bytes.end());
+		}, true));
+	}
+
+	// Returned by Directory::get_or_placeholder while an asset of type T is loading
+	template <typename T>
+	void placeholder(T&& value) {
+		m_placeholders.try_emplace(typeId<T>, typeId<T>).first->second.template emplace<std::decay_t<T>>(std::forward<T>(value));
+	}
+
+	// Throws std::logic_error if none was set for T
+	template <typename T>
+	T& placeholder() {
+		auto placeholderIt = m_placeholders.find(typeId<T>);
+		if (placeholderIt == m_placeholders.end())
+			throw std::logic_error("No placeholder set for this type, see AssetManager::placeholder");
+		return placeholderIt->second.template get<T>();
+	}
+
+	// Byte budget over all directories. Directory::synchronize evicts least recently used assets of that
+	// directory not accessed since the previous synchronize and not pinned, evicted assets reload on next get.
+	// Assets of all types count against it, only evictable types are evicted.
+	// Asset size is T::memoryUsage() if present and sizeof(T) otherwise.
+	void budget(size_t bytes) { m_budget = bytes; }
+
+	// Byte budget for assets of type T, makes T evictable
+	template <typename T>
+	void budget(size_t bytes) { 
+		m_typeBudgets[typeId<T>] = bytes;
+		evictable<T>();
+	}
+
+	// Allow budgets to evict assets of type T. A reference returned by get for such an asset is only valid until the
+	// next synchronize, hold a Directory::pin to keep the value across frames.
+	template <typename T>
+	void evictable(bool enable = true) {
+		if (enable)
+			m_evictable.insert(typeId<T>);
+		else
+			m_evictable.erase(typeId<T>);
+	}
+
+	template <typename T>
+	size_t residentBytes() const { return residentBytes(typeId<T>); }
+
+	size_t residentBytes(TypeId type = nullptr) const {
+		size_t bytes = 0;
+		for (const auto& [path, directory] : m_directories)
+			bytes += directory.residentBytes(type);
+		return bytes;
 	}
 
 private:
+	// Declared before the directories so they outlive assets with queued loads
+	LoadScheduler		  m_scheduler;
+	UploadQueue			  m_uploads{};
+	std::unique_ptr<DerivedDataCache> m_cache{};
 	PathToTMap<Directory> m_directories{};
 
+	std::unordered_map<TypeId, MoveOnlyAny> m_placeholders{};
+
+	size_t							   m_budget = SIZE_MAX;
+	std::unordered_map<TypeId, size_t> m_typeBudgets{};
+	std::unordered_set<TypeId>		   m_evictable{};
+
 private:
+	// derived, returning the cache entry instead of the computed bytes on a miss if map is set
+	static std::unique_ptr<FileView> derive(const DerivedDataCache::Key& key, const std::function<std::vector<std::byte>()>& compute, bool map);
+
 	static const std::wstring_view fileExtension(const std::wstring& filePath) {
 		size_t pos = filePath.rfind('.');
 		if (pos == std::wstring::npos)
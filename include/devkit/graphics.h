@@ -1,7 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <vector>
 #include <optional>
+#include <span>
+#include <type_traits>
 #include <unordered_map>
 
 #include <imgui.h>
@@ -30,6 +35,8 @@ class Shader;
 enum class Primitive : unsigned int 
 { Points = 0x0000, Lines = 0x0001, LineLoop = 0x0002, LineStrip = 0x0003, Triangles = 0x0004 };
 
+class IndexBufferBase;
+
 // TODO: check for initialization gl context
 class VertexBufferBase {
 public:
@@ -42,6 +49,7 @@ public:
 
 	~VertexBufferBase();
 
+	// Marks the vertex for upload on the next bind
 	template <typename... Ts>
 	reverse_tuple<Ts...>& at(size_t index) {
 		return *reinterpret_cast<reverse_tuple<Ts...>*>(at_impl(index));
@@ -52,16 +60,34 @@ public:
 		return *reinterpret_cast<reverse_tuple<Ts...>*>(at_impl(index));
 	}
 
+	// Copy count vertices of the buffer's layout to index, uploaded on the next bind
+	void write(size_t index, const void* vertices, size_t count);
+
 	void bind() const;
 
 	void draw(Primitive primitive) const;
 	void draw(Primitive primitive, Shader& shader) const;
 
+	// Draws the vertices referenced by indices, the index buffer stays attached to this buffer's VAO until another is drawn
+	void drawIndexed(Primitive primitive, const IndexBufferBase& indices) const;
+	void drawIndexed(Primitive primitive, const IndexBufferBase& indices, Shader& shader) const;
+
+	// Draws instanceCount copies in one call, the attributes of instances take the locations after this buffer's own
+	void drawInstanced(Primitive primitive, const VertexBufferBase& instances, size_t instanceCount) const;
+	void drawInstanced(Primitive primitive, const VertexBufferBase& instances, size_t instanceCount, Shader& shader) const;
+	void drawIndexedInstanced(Primitive primitive, const IndexBufferBase& indices, const VertexBufferBase& instances, size_t instanceCount) const;
+	void drawIndexedInstanced(Primitive primitive, const IndexBufferBase& indices, const VertexBufferBase& instances, size_t instanceCount, Shader& shader) const;
+
+protected:
+	// Instances drawn per element of this buffer when it feeds instanced draws, 0 advances per vertex
+	void setDivisor(unsigned divisor);
+
 private:
 	class Impl; std::unique_ptr<Impl> m_impl;
 
 	VertexBufferBase(size_t size, std::vector<GLType>&& types, uintptr_t data);
 
+	uintptr_t at_impl(size_t index);
 	uintptr_t at_impl(size_t index) const;
 };
 
@@ -85,8 +111,80 @@ public:
 	const Vertex& at(size_t index) const {
 		return VertexBufferBase::at<Ts...>(index);
 	}
+
+	void write(size_t index, std::span<const Vertex> vertices) {
+		VertexBufferBase::write(index, vertices.data(), vertices.size());
+	}
+};
+
+// Per-instance attribute stream, element i feeds instances [i * divisor, (i + 1) * divisor)
+template <typename... Ts>
+class InstanceBuffer : public VertexBuffer<Ts...> {
+public:
+	using Instance = typename VertexBuffer<Ts...>::Vertex;
+
+	InstanceBuffer(size_t size = 0, unsigned divisor = 1)
+		: VertexBuffer<Ts...>(size)
+	{
+		this->setDivisor(divisor);
+	}
+
+	InstanceBuffer(std::vector<Instance>&& instances, unsigned divisor = 1)
+		: VertexBuffer<Ts...>(std::move(instances))
+	{
+		this->setDivisor(divisor);
+	}
+};
+
+class IndexBufferBase {
+public:
+	~IndexBufferBase();
+
+	size_t count() const;
+
+private:
+	friend class VertexBufferBase;
+	template <typename T> friend class IndexBuffer;
+
+	class Impl; std::unique_ptr<Impl> m_impl;
+
+	IndexBufferBase(size_t count, GLType type, const void* data);
 };
 
+// Immutable once created, meant for geometry that is built or imported once
+template <typename T>
+class IndexBuffer : public IndexBufferBase {
+public:
+	static_assert(std::is_same_v<T, uint16_t> || std::is_same_v<T, uint32_t>, "Index buffers hold uint16_t or uint32_t indices");
+
+	IndexBuffer(std::span<const T> indices)
+		: IndexBufferBase(indices.size(), GLType::get<T>(), indices.data())
+	{ }
+};
+
+// Import-time preparation of indexed meshes, the vertex type is compared and moved as raw bytes
+size_t weldVertices(std::byte* vertices, size_t count, size_t vertexSize, uint32_t* indices, size_t maxIndex);
+void optimizeMesh(std::byte* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indices, size_t indexCount);
+
+// Merges bitwise identical vertices of a triangle list in place, returns the indices that rebuild the list.
+// Throws std::length_error, leaving vertices unchanged, if the merged vertices don't fit Index.
+template <typename Index = uint32_t, typename Vertex>
+std::vector<Index> weld(std::vector<Vertex>& vertices) {
+	std::vector<uint32_t> indices(vertices.size());
+	size_t count = weldVertices(reinterpret_cast<std::byte*>(vertices.data()), vertices.size(), sizeof(Vertex), indices.data(), std::numeric_limits<Index>::max());
+	vertices.resize(count);
+	return std::vector<Index>(indices.begin(), indices.end());
+}
+
+// Orders triangles for the post-transform vertex cache, then vertices by first use for fetch locality.
+// Throws std::out_of_range if an index doesn't address a vertex.
+template <typename Index, typename Vertex>
+void optimize(std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+	std::vector<uint32_t> wide(indices.begin(), indices.end());
+	optimizeMesh(reinterpret_cast<std::byte*>(vertices.data()), vertices.size(), sizeof(Vertex), wide.data(), wide.size());
+	std::copy(wide.begin(), wide.end(), indices.begin());
+}
+
 }
 
 namespace NS_DEVKIT {
@@ -99,8 +197,10 @@ public:
 	ShaderSource(std::string&& source);
 
 	static ShaderSource loadFromFile(const wchar_t* path);
+	static ShaderSource loadFromView(const AssetManager::FileView& file);
 
 	void updateFromFile(const wchar_t* path);
+	void updateFromView(const AssetManager::FileView& file);
 
 	bool compile(unsigned type, unsigned& id);
 
@@ -158,6 +258,7 @@ class Texture {
 public:
 	enum class Filter { NEAREST = 0x2600, LINEAR = 0x2601 };
 	struct Properties;
+	struct Image;
 
 	Texture();
 	Texture(Texture::Properties properties);
@@ -170,7 +271,16 @@ public:
 	unsigned char* getPixelBuffer();
 	void save(const wchar_t* path);
 	static Texture load(const wchar_t* path);
+	static Texture loadFromView(const AssetManager::FileView& file);
 	void update(const wchar_t* path);
+	void updateFromView(const AssetManager::FileView& file);
+
+	// Two phase loading, decode on any thread and upload on the GL thread:
+	// am.ext(L".png", AssetManager::staged(&Texture::decode, &Texture::upload), Execution::Async)
+	// am.ext(L".png", AssetManager::staged(&Texture::decode, &Texture::reupload), Execution::Async)
+	static Image decode(const AssetManager::FileView& file);
+	static Texture upload(Image&& image);
+	void reupload(Image&& image);
 
 	~Texture();
 
@@ -186,6 +296,14 @@ struct Texture::Properties {
 	glm::u32vec2 size = { 32, 32 };
 };
 
+// Decoded RGBA pixels
+struct Texture::Image {
+	std::shared_ptr<unsigned char> pixels;
+	glm::i32vec2				   size = { 0, 0 };
+
+	size_t memoryUsage() const { return (size_t)size.x * size.y * 4; }
+};
+
 }
 
 namespace NS_DEVKIT {
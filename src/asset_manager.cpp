@@ -0,0 +1,812 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include <lz4.h>
+
+#include "devkit/devkit.h"
+#include "devkit/log.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#undef DELETE
+#elif defined(__linux__)
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace NS_DEVKIT;
+
+namespace fs = std::filesystem;
+
+#if defined(_WIN32)
+
+class ReadDirectoryChangesWatcher : public AssetManager::Watcher {
+public:
+    ReadDirectoryChangesWatcher(HANDLE directory, const fs::path& root)
+        : m_directory(directory)
+        , m_root(root)
+    {
+        m_overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        m_complete = issue();
+    }
+
+    bool watching() const { return m_complete; }
+
+    bool poll(std::vector<std::wstring>& changed) override {
+        bool complete = m_complete;
+        m_complete = true;
+
+        DWORD bytes = 0;
+        while (GetOverlappedResult(m_directory, &m_overlapped, &bytes, FALSE)) {
+            // Zero bytes means the buffer overflowed and events were lost
+            if (bytes == 0)
+                complete = false;
+            else
+                parse(changed);
+
+            if (!issue())
+                return false;
+        }
+
+        // Anything but a pending read is an error, reissue and ask for a rescan
+        if (GetLastError() != ERROR_IO_INCOMPLETE) {
+            issue();
+            return false;
+        }
+
+        return complete;
+    }
+
+    ~ReadDirectoryChangesWatcher() override {
+        DWORD bytes = 0;
+        CancelIoEx(m_directory, &m_overlapped);
+        GetOverlappedResult(m_directory, &m_overlapped, &bytes, TRUE);
+        CloseHandle(m_overlapped.hEvent);
+        CloseHandle(m_directory);
+    }
+
+private:
+    static constexpr DWORD c_filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+                                    | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+    HANDLE             m_directory;
+    fs::path           m_root;
+    OVERLAPPED         m_overlapped{};
+    std::vector<DWORD> m_buffer = std::vector<DWORD>(16 * 1024); // 64KiB, limit for network shares
+    bool               m_complete = true;
+
+    bool issue() {
+        return ReadDirectoryChangesW(m_directory, m_buffer.data(), (DWORD)(m_buffer.size() * sizeof(DWORD)),
+                                     TRUE, c_filter, nullptr, &m_overlapped, nullptr);
+    }
+
+    void parse(std::vector<std::wstring>& changed) {
+        auto* bytes = reinterpret_cast<const std::byte*>(m_buffer.data());
+        while (true) {
+            const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(bytes);
+            fs::path path = m_root / std::wstring_view(info->FileName, info->FileNameLength / sizeof(wchar_t));
+
+            // Directory write times change with their contents, only creation and removal matter
+            DWORD attributes = GetFileAttributesW(path.c_str());
+            bool directoryModified = info->Action == FILE_ACTION_MODIFIED
+                && attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+            if (!directoryModified)
+                changed.push_back(path.wstring());
+
+            if (info->NextEntryOffset == 0)
+                break;
+            bytes += info->NextEntryOffset;
+        }
+    }
+};
+
+#elif defined(__linux__)
+
+class InotifyWatcher : public AssetManager::Watcher {
+public:
+    InotifyWatcher(int fd, const fs::path& root)
+        : m_fd(fd)
+    {
+        addRecursive(root);
+    }
+
+    bool watching() const { return !m_directories.empty(); }
+
+    bool poll(std::vector<std::wstring>& changed) override {
+        bool complete = m_complete;
+        m_complete = true;
+
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (true) {
+            ssize_t length = read(m_fd, buffer, sizeof(buffer));
+            if (length < 0 && errno == EINTR)
+                continue;
+            if (length <= 0)
+                break; // Queue drained
+
+            for (char* it = buffer; it < buffer + length; ) {
+                const auto* event = reinterpret_cast<const inotify_event*>(it);
+                it += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    complete = false;
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    m_directories.erase(event->wd);
+                    continue;
+                }
+
+                // Skip events on watched directories themselves and directory attribute changes
+                auto directoryIt = m_directories.find(event->wd);
+                if (directoryIt == m_directories.end() || event->len == 0)
+                    continue;
+                if ((event->mask & IN_ISDIR) && !(event->mask & c_directoryMask))
+                    continue;
+
+                fs::path path = directoryIt->second / event->name;
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                    addRecursive(path);
+                changed.push_back(path.wstring());
+            }
+        }
+
+        return complete;
+    }
+
+    ~InotifyWatcher() override { close(m_fd); }
+
+private:
+    static constexpr uint32_t c_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+                                     | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    static constexpr uint32_t c_directoryMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+    int                                m_fd;
+    std::unordered_map<int, fs::path>  m_directories{};
+    bool                               m_complete = true;
+
+    void add(const fs::path& directory) {
+        int wd = inotify_add_watch(m_fd, directory.c_str(), c_mask);
+        if (wd < 0) {
+            // Changes below directory would go unnoticed, ask for a rescan
+            ERR("Failed to watch {} (errno {})", directory.string(), errno);
+            m_complete = false;
+            return;
+        }
+        m_directories[wd] = directory;
+    }
+
+    void addRecursive(const fs::path& directory) {
+        std::error_code error;
+        add(directory);
+        for (fs::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+            if (it->is_directory(error))
+                add(it->path());
+    }
+};
+
+#endif
+
+std::unique_ptr<AssetManager::Watcher> AssetManager::Watcher::create(const std::wstring& path)
+{
+#if defined(_WIN32)
+    HANDLE directory = CreateFileW(path.c_str(), FILE_LIST_DIRECTORY,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                   OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (directory == INVALID_HANDLE_VALUE) {
+        ERR("Failed to open {} for watching", utf8(path.c_str()));
+        return nullptr;
+    }
+
+    auto watcher = std::make_unique<ReadDirectoryChangesWatcher>(directory, path);
+    if (!watcher->watching())
+        return nullptr;
+    return watcher;
+#elif defined(__linux__)
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        ERR("Failed to initialize inotify (errno {})", errno);
+        return nullptr;
+    }
+
+    auto watcher = std::make_unique<InotifyWatcher>(fd, path);
+    if (!watcher->watching())
+        return nullptr;
+    return watcher;
+#else
+    return nullptr;
+#endif
+}
+
+#if defined(_WIN32)
+
+class MappedFileView : public AssetManager::FileView {
+public:
+    MappedFileView(const wchar_t* path, HANDLE file)
+        : FileView(path)
+        , m_file(file)
+    {
+        BY_HANDLE_FILE_INFORMATION info;
+        if (!GetFileInformationByHandle(m_file, &info))
+            return;
+        uint64_t size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        m_identity = { 
+            info.dwVolumeSerialNumber, 
+            ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow, 
+            size,
+            (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime) 
+        };
+
+        // Empty files can't be mapped
+        m_valid = true;
+        if (size == 0)
+            return;
+
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void* view = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        m_valid = view != nullptr;
+        if (view)
+            m_data = { static_cast<const std::byte*>(view), (size_t)size };
+    }
+
+    bool valid() const { return m_valid; }
+
+    ~MappedFileView() override {
+        if (!m_data.empty())
+            UnmapViewOfFile(m_data.data());
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+    }
+
+private:
+    HANDLE m_file;
+    HANDLE m_mapping = nullptr;
+    bool   m_valid = false;
+};
+
+#elif defined(__linux__)
+
+class MappedFileView : public AssetManager::FileView {
+public:
+    MappedFileView(const wchar_t* path, int fd)
+        : FileView(path)
+    {
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            return;
+        m_identity = { 
+            (uint64_t)info.st_dev, 
+            (uint64_t)info.st_ino, 
+            (uint64_t)info.st_size, 
+            (int64_t)info.st_mtim.tv_sec * 1'000'000'000 + info.st_mtim.tv_nsec 
+        };
+
+        // Empty files can't be mapped
+        m_valid = true;
+        if (info.st_size == 0)
+            return;
+
+        // Mapping stays valid after the descriptor is closed
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        m_valid = view != MAP_FAILED;
+        if (m_valid)
+            m_data = { static_cast<const std::byte*>(view), (size_t)info.st_size };
+    }
+
+    bool valid() const { return m_valid; }
+
+    ~MappedFileView() override {
+        if (!m_data.empty())
+            munmap(const_cast<std::byte*>(m_data.data()), m_data.size());
+    }
+
+private:
+    bool m_valid = false;
+};
+
+#else
+
+// No mapping available, reads the file into memory instead
+class MappedFileView : public AssetManager::FileView {
+public:
+    MappedFileView(const wchar_t* path)
+        : FileView(path)
+    {
+        std::error_code error;
+        uint64_t size = fs::file_size(path, error);
+        std::ifstream ifs(fs::path(path), std::ios::binary);
+        if (error || !ifs)
+            return;
+
+        m_buffer.resize((size_t)size);
+        m_valid = (bool)ifs.read(reinterpret_cast<char*>(m_buffer.data()), m_buffer.size());
+        m_data = m_buffer;
+        m_identity = { 0, 0, size, fs::last_write_time(path, error).time_since_epoch().count() };
+    }
+
+    bool valid() const { return m_valid; }
+
+private:
+    std::vector<std::byte> m_buffer;
+    bool                   m_valid = false;
+};
+
+#endif
+
+std::unique_ptr<AssetManager::FileView> AssetManager::FileView::map(const wchar_t* path)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        ERR("Failed to open {} for mapping", utf8(path));
+        return nullptr;
+    }
+    auto view = std::make_unique<MappedFileView>(path, file);
+#elif defined(__linux__)
+    int fd = open(fs::path(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ERR("Failed to open {} for mapping (errno {})", utf8(path), errno);
+        return nullptr;
+    }
+    auto view = std::make_unique<MappedFileView>(path, fd);
+    close(fd);
+#else
+    auto view = std::make_unique<MappedFileView>(path);
+#endif
+
+    if (!view->valid()) {
+        ERR("Failed to map {}", utf8(path));
+        return nullptr;
+    }
+    return view;
+}
+
+// Pack entry, pointing into the mapped pack or owning its decompressed contents
+class PackedFileView : public AssetManager::FileView {
+public:
+    PackedFileView(const wchar_t* path, const AssetManager::Pack::Entry& entry, std::span<const std::byte> data)
+        : FileView(path)
+    {
+        m_data = data;
+        m_identity = { 0, entry.offset, entry.originalSize, entry.writeTime };
+    }
+
+    PackedFileView(const wchar_t* path, const AssetManager::Pack::Entry& entry, std::vector<std::byte>&& buffer)
+        : PackedFileView(path, entry, std::span<const std::byte>())
+    {
+        m_buffer = std::move(buffer);
+        m_data = m_buffer;
+    }
+
+private:
+    std::vector<std::byte> m_buffer{};
+};
+
+std::unique_ptr<AssetManager::Pack> AssetManager::Pack::open(const wchar_t* file, std::wstring root)
+{
+    auto view = FileView::map(file);
+    if (!view)
+        return nullptr;
+
+    // Validate everything lookups and views rely on once, entries are trusted afterwards
+    std::span<const std::byte> data = view->data();
+    const auto* header = reinterpret_cast<const Header*>(data.data());
+    bool valid = data.size() >= sizeof(Header) && header->magic == c_magic && header->version == c_version
+        && header->indexOffset % alignof(Entry) == 0
+        && header->indexOffset <= data.size()
+        && header->entryCount <= (data.size() - header->indexOffset) / sizeof(Entry)
+        && header->stringsOffset <= data.size()
+        && header->stringsSize <= data.size() - header->stringsOffset;
+    if (!valid) {
+        ERR("{} is not a valid asset pack", utf8(file));
+        return nullptr;
+    }
+
+    std::unique_ptr<Pack> pack(new Pack(std::move(view), std::move(root)));
+    pack->m_entries = { reinterpret_cast<const Entry*>(data.data() + header->indexOffset), (size_t)header->entryCount };
+    pack->m_strings = { reinterpret_cast<const char*>(data.data() + header->stringsOffset), (size_t)header->stringsSize };
+    for (const auto& entry : pack->m_entries) {
+        bool inBounds = entry.offset <= data.size() && entry.size <= data.size() - entry.offset
+            && (uint64_t)entry.pathOffset + entry.pathSize <= header->stringsSize
+            && ((entry.flags & Compressed) || entry.size == entry.originalSize)
+            // Pack::write only compresses what LZ4 can address and keeps it if it shrank, view passes both sizes as int
+            && (!(entry.flags & Compressed) || (entry.originalSize <= LZ4_MAX_INPUT_SIZE && entry.size <= entry.originalSize));
+        if (!inBounds) {
+            ERR("{} has an entry out of bounds", utf8(file));
+            return nullptr;
+        }
+    }
+    return pack;
+}
+
+std::unique_ptr<AssetManager::FileView> AssetManager::Pack::view(const wchar_t* path) const
+{
+    std::u8string relative = fs::path(path).lexically_relative(m_root).generic_u8string();
+    const Entry* entry = find({ reinterpret_cast<const char*>(relative.data()), relative.size() });
+    if (!entry) {
+        ERR("{} is not packed", utf8(path));
+        return nullptr;
+    }
+
+    auto stored = m_file->data().subspan((size_t)entry->offset, (size_t)entry->size);
+    if (!(entry->flags & Compressed))
+        return std::make_unique<PackedFileView>(path, *entry, stored);
+
+    std::vector<std::byte> buffer((size_t)entry->originalSize);
+    int size = LZ4_decompress_safe(reinterpret_cast<const char*>(stored.data()), reinterpret_cast<char*>(buffer.data()),
+                                   (int)stored.size(), (int)buffer.size());
+    if (size < 0 || (size_t)size != buffer.size()) {
+        ERR("Failed to decompress {}", utf8(path));
+        return nullptr;
+    }
+    return std::make_unique<PackedFileView>(path, *entry, std::move(buffer));
+}
+
+bool AssetManager::Pack::write(const wchar_t* directory, const wchar_t* output, bool compress)
+{
+    struct File {
+        fs::path    path;
+        std::string relative;
+        Entry       entry;
+    };
+
+    // Sort by relative path, the order lookups binary search in
+    std::vector<File> files;
+    std::error_code error;
+    for (fs::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        if (!it->is_regular_file(error))
+            continue;
+        std::u8string relative = it->path().lexically_relative(directory).generic_u8string();
+        Entry entry{};
+        entry.writeTime = it->last_write_time(error).time_since_epoch().count();
+        files.push_back({ it->path(), std::string(relative.begin(), relative.end()), entry });
+    }
+    if (error) {
+        ERR("Failed to walk {}", utf8(directory));
+        return false;
+    }
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.relative < b.relative; });
+
+    std::ofstream out(fs::path(output), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        ERR("Failed to open {} for writing", utf8(output));
+        return false;
+    }
+
+    auto pad = [&](uint64_t alignment) {
+        static const char zeros[c_alignment] = {};
+        uint64_t position = (uint64_t)out.tellp();
+        out.write(zeros, (std::streamsize)((alignment - position % alignment) % alignment));
+        return (uint64_t)out.tellp();
+    };
+
+    // Header is rewritten once offsets are known
+    Header header;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<char> contents, compressed;
+    std::string strings;
+    for (auto& file : files) {
+        std::ifstream in(file.path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (in.bad()) {
+            ERR("Failed to read {}", utf8(file.path.wstring().c_str()));
+            return false;
+        }
+
+        Entry& entry = file.entry;
+        entry.originalSize = contents.size();
+        entry.pathOffset = (uint32_t)strings.size();
+        entry.pathSize = (uint32_t)file.relative.size();
+        strings += file.relative;
+
+        // Keep compressed data only if it's smaller
+        std::span<const char> stored = contents;
+        if (compress && !contents.empty() && contents.size() <= LZ4_MAX_INPUT_SIZE) {
+            compressed.resize(LZ4_compressBound((int)contents.size()));
+            int size = LZ4_compress_default(contents.data(), compressed.data(), (int)contents.size(), (int)compressed.size());
+            if (size > 0 && (size_t)size < contents.size()) {
+                stored = { compressed.data(), (size_t)size };
+                entry.flags |= Compressed;
+            }
+        }
+
+        entry.offset = pad(c_alignment);
+        entry.size = stored.size();
+        out.write(stored.data(), (std::streamsize)stored.size());
+    }
+
+    header.entryCount = files.size();
+    header.indexOffset = pad(alignof(Entry));
+    for (const auto& file : files)
+        out.write(reinterpret_cast<const char*>(&file.entry), sizeof(Entry));
+    header.stringsOffset = (uint64_t)out.tellp();
+    header.stringsSize = strings.size();
+    out.write(strings.data(), (std::streamsize)strings.size());
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!out) {
+        ERR("Failed to write {}", utf8(output));
+        return false;
+    }
+    return true;
+}
+
+// Cache entry, or the output of a miss that couldn't be cached
+class DerivedFileView : public AssetManager::FileView {
+public:
+    DerivedFileView(std::wstring path, std::unique_ptr<FileView> file)
+        : FileView(nullptr)
+        , m_file(std::move(path))
+        , m_view(std::move(file))
+    {
+        m_path = m_file.c_str();
+        m_data = m_view->data();
+        m_identity = m_view->identity();
+    }
+
+    DerivedFileView(std::vector<std::byte>&& buffer)
+        : FileView(L"")
+        , m_buffer(std::move(buffer))
+    {
+        m_data = m_buffer;
+        m_identity.size = m_buffer.size();
+    }
+
+private:
+    std::wstring              m_file{};
+    std::unique_ptr<FileView> m_view{};
+    std::vector<std::byte>    m_buffer{};
+};
+
+AssetManager::DerivedDataCache::DerivedDataCache(std::wstring directory, uint64_t maxBytes)
+    : m_directory(std::move(directory))
+    , m_maxBytes(maxBytes)
+    , m_instance(((uint64_t)std::random_device()() << 32) | std::random_device()())
+{
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    if (error)
+        ERR("Failed to create cache directory {}", utf8(m_directory.c_str()));
+
+    uint64_t bytes = 0;
+    for (fs::directory_iterator it(m_directory, error), end; !error && it != end; it.increment(error))
+        if (it->is_regular_file(error))
+            bytes += it->file_size(error);
+    m_bytes = bytes;
+}
+
+std::unique_ptr<AssetManager::FileView> AssetManager::DerivedDataCache::load(const Key& key) const
+{
+    // Refreshing the write time keeps the entry off the trim list, and fails for missing entries
+    std::wstring file = path(key);
+    std::error_code error;
+    fs::last_write_time(file, fs::file_time_type::clock::now(), error);
+    if (error)
+        return nullptr;
+
+    auto view = FileView::map(file.c_str());
+    if (!view)
+        return nullptr;
+    return std::make_unique<DerivedFileView>(std::move(file), std::move(view));
+}
+
+bool AssetManager::DerivedDataCache::store(const Key& key, std::span<const std::byte> data)
+{
+    std::wstring file = path(key);
+    std::wstring temporary = std::format(L"{}.{:016x}-{}.tmp", file, m_instance, m_temporaryCount++);
+    {
+        std::ofstream out(fs::path(temporary), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(data.data()), (std::streamsize)data.size());
+        if (!out.flush()) {
+            ERR("Failed to write cache entry {}", utf8(temporary.c_str()));
+            out.close();
+            std::error_code error;
+            fs::remove(temporary, error);
+            return false;
+        }
+    }
+
+    // Fails on Windows if another process stored the same entry first and still has it open
+    std::error_code error;
+    fs::rename(temporary, file, error);
+    if (error) {
+        fs::remove(temporary, error);
+        return fs::exists(file, error);
+    }
+
+    if ((m_bytes += data.size()) > m_maxBytes)
+        trim();
+    return true;
+}
+
+void AssetManager::DerivedDataCache::trim()
+{
+    // Another thread is already trimming
+    std::unique_lock lock(m_trimMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    struct Entry {
+        fs::path            path;
+        fs::file_time_type  writeTime;
+        uint64_t            size;
+    };
+
+    // Temporary and lock files of stores in flight are counted but never deleted
+    std::vector<Entry> entries;
+    uint64_t bytes = 0;
+    std::error_code error;
+    for (fs::directory_iterator it(m_directory, error), end; !error && it != end; it.increment(error)) {
+        std::error_code entryError;
+        if (!it->is_regular_file(entryError))
+            continue;
+        Entry entry{ it->path(), it->last_write_time(entryError), it->file_size(entryError) };
+        if (entryError)
+            continue;
+        bytes += entry.size;
+        if (entry.path.extension() != L".tmp" && entry.path.extension() != L".lock")
+            entries.push_back(std::move(entry));
+    }
+
+    // Oldest first, down to three quarters of the limit so the next stores don't trim again
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.writeTime < b.writeTime; });
+    uint64_t target = m_maxBytes / 4 * 3;
+    for (const auto& entry : entries) {
+        if (bytes <= target)
+            break;
+        // Entries other processes have mapped can stay behind, they go in a later trim
+        if (fs::remove(entry.path, error))
+            bytes -= entry.size;
+    }
+    m_bytes = bytes;
+}
+
+std::wstring AssetManager::DerivedDataCache::path(const Key& key) const
+{
+    return (fs::path(m_directory) / std::format(L"{:016x}-{:016x}-{:016x}", key.source, key.version, key.options)).wstring();
+}
+
+bool AssetManager::DerivedDataCache::lock(const Key& key)
+{
+    std::wstring file = path(key) + L".lock";
+#if defined(_WIN32)
+    // Unshared, and deleted once the handle closes, also when the process dies
+    HANDLE handle = CreateFileW(file.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    intptr_t lockHandle = (intptr_t)handle;
+#elif defined(__linux__)
+    fs::path lockPath(file);
+    int fd = -1;
+    while (true) {
+        fd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            close(fd);
+            return false;
+        }
+
+        // The previous holder unlinks the file before releasing it, retry if this one isn't at the path anymore
+        struct stat opened, current;
+        if (fstat(fd, &opened) == 0 && stat(lockPath.c_str(), &current) == 0
+            && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+            break;
+        close(fd);
+    }
+    intptr_t lockHandle = fd;
+#else
+    // No file locks, every process computes its own copy
+    return true;
+#endif
+#if defined(_WIN32) || defined(__linux__)
+    std::lock_guard lock(m_lockMutex);
+    m_locks.emplace(std::move(file), lockHandle);
+    return true;
+#endif
+}
+
+void AssetManager::DerivedDataCache::unlock(const Key& key)
+{
+    std::wstring file = path(key) + L".lock";
+    intptr_t lockHandle;
+    {
+        std::lock_guard lock(m_lockMutex);
+        auto lockIt = m_locks.find(file);
+        if (lockIt == m_locks.end())
+            return;
+        lockHandle = lockIt->second;
+        m_locks.erase(lockIt);
+    }
+
+#if defined(_WIN32)
+    CloseHandle((HANDLE)lockHandle);
+#elif defined(__linux__)
+    // Unlinked while still locked, so the file at the path is never one that was released
+    unlink(fs::path(file).c_str());
+    close((int)lockHandle);
+#endif
+}
+
+bool AssetManager::DerivedDataCache::held(const std::wstring& lockFile)
+{
+#if defined(_WIN32)
+    // Only exists while a holder has it open
+    return GetFileAttributesW(lockFile.c_str()) != INVALID_FILE_ATTRIBUTES;
+#elif defined(__linux__)
+    int fd = open(fs::path(lockFile).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool held = flock(fd, LOCK_SH | LOCK_NB) != 0;
+    close(fd);
+    return held;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<AssetManager::FileView> AssetManager::DerivedDataCache::wait(const Key& key) const
+{
+    std::wstring lock = path(key) + L".lock";
+    while (true) {
+        if (auto view = load(key))
+            return view;
+
+        // Released, the entry was stored in between or the holder failed or died
+        if (!held(lock))
+            return load(key);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+std::unique_ptr<AssetManager::FileView> AssetManager::derive(const DerivedDataCache::Key& key, 
+                                                             const std::function<std::vector<std::byte>()>& compute, bool map)
+{
+    if (!s_cache)
+        return std::make_unique<DerivedFileView>(compute());
+
+    if (auto view = s_cache->load(key))
+        return view;
+
+    // Someone else is computing key, use their result. If they didn't store it, compute it under the lock ourselves.
+    bool locked = s_cache->lock(key);
+    if (!locked) {
+        if (auto view = s_cache->wait(key))
+            return view;
+        locked = s_cache->lock(key);
+    }
+
+    std::vector<std::byte> output;
+    try {
+        output = compute();
+    }
+    catch (...) {
+        if (locked)
+            s_cache->unlock(key);
+        throw;
+    }
+
+    bool stored = s_cache->store(key, output);
+    if (locked)
+        s_cache->unlock(key);
+
+    if (map && stored) {
+        if (auto view = s_cache->load(key))
+            return view;
+    }
+    return std::make_unique<DerivedFileView>(std::move(output));
+}
@@ -1,5 +1,11 @@
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 
 #include "devkit/graphics.h"
 #include "devkit/log.h"
@@ -11,6 +17,17 @@
 
 using namespace NS_DEVKIT;
 
+namespace {
+
+// Identifies buffers for the lifetime of the process, GL names are reused after deletion
+uint64_t nextSerial() {
+    static std::atomic<uint64_t> serials = 0;
+    return ++serials;
+}
+
+}
+
+// Each buffer owns its VAO, the attribute layout recorded in it once makes binding a single call
 struct OpenGLVertexBufferImpl {
     GLuint id = 0;
     GLuint vao = 0;
@@ -18,13 +35,7 @@ struct OpenGLVertexBufferImpl {
     OpenGLVertexBufferImpl() 
     { 
         glGenBuffers(1, &id); 
-
-        GLint currentVAO;
-        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &currentVAO);
-        if (0 != currentVAO)
-            vao = currentVAO;
-        else
-            glGenVertexArrays(1, &vao);
+        glGenVertexArrays(1, &vao);
     }
 
     void bind() 
@@ -33,7 +44,11 @@ struct OpenGLVertexBufferImpl {
         glBindBuffer(GL_ARRAY_BUFFER, id);
     }
     
-    ~OpenGLVertexBufferImpl() { glDeleteBuffers(1, &id); }
+    ~OpenGLVertexBufferImpl() 
+    { 
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &id); 
+    }
 };
 
 struct VertexBufferBase::Impl {
@@ -44,10 +59,21 @@ struct VertexBufferBase::Impl {
     std::vector<std::byte> m_data;
     size_t                 m_count;
 
-    bool                   m_inited = false;
+    // Pages of m_data changed since the last upload, one bit each
+    static constexpr size_t c_pageSize = 4096;
+    // Clean pages between two dirty runs that are cheaper to upload than a separate glBufferSubData call
+    static constexpr size_t c_mergePages = 4;
+
     bool                   m_changed = false;
-    int	    	           m_minUpdatedIndex = 0;
-    int	    	           m_maxUpdatedIndex = 0;
+    std::vector<uint64_t>  m_dirtyPages;
+
+    uint64_t               m_serial = nextSerial();
+    unsigned               m_divisor = 0;
+
+    // Serials of the index and instance buffers attached to the VAO, 0 for none
+    uint64_t               m_indices = 0;
+    uint64_t               m_instances = 0;
+    GLuint                 m_instanceAttributes = 0;
 
     Impl(size_t size, std::vector<GLType>&& types, uintptr_t data)
         : m_glVertexBuffer()
@@ -62,39 +88,79 @@ struct VertexBufferBase::Impl {
         if (data)
             std::memcpy(m_data.data(), reinterpret_cast<std::byte*>(data), m_data.size());
 
-        m_minUpdatedIndex = std::numeric_limits<int>::max();
-        m_maxUpdatedIndex = -1;
+        size_t pageCount = (m_data.size() + c_pageSize - 1) / c_pageSize;
+        m_dirtyPages.resize((pageCount + 63) / 64);
+
+        // Upload and bake the layout, leaving whatever VAO the caller had bound
+        GLint previousVAO;
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+        m_glVertexBuffer.bind();
+        glBufferData(GL_ARRAY_BUFFER, m_data.size(), m_data.data(), GL_STATIC_DRAW);
+        enableVertexAttribPointers(0, false);
+        glBindVertexArray(previousVAO);
     }
 
     void bind() { 
-        m_glVertexBuffer.bind();
+        glBindVertexArray(m_glVertexBuffer.vao);
+        flush();
+    }
 
-        if (!m_inited) {
-            m_inited = true;
-            glBufferData(GL_ARRAY_BUFFER, m_vertexSize * m_count, m_data.data(), GL_STATIC_DRAW);
-        }
-        else
+    // Uploads pending changes without touching the VAO binding
+    void flush() {
+        if (m_changed) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer.id);
             update();
+        }
+    }
+
+    // Element array bindings are VAO state, attach only when a different index buffer is drawn
+    void bindIndices(GLuint id, uint64_t serial) {
+        if (m_indices == serial)
+            return;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+        m_indices = serial;
+    }
+
+    // Instance attribute pointers are VAO state too, recorded again only when a different instance buffer is drawn
+    void attachInstances(const Impl& instances) {
+        if (m_instances == instances.m_serial)
+            return;
+
+        GLuint first = (GLuint)m_types.size();
+        glBindBuffer(GL_ARRAY_BUFFER, instances.m_glVertexBuffer.id);
+        instances.enableVertexAttribPointers(first, true);
+
+        // Left over from a wider instance buffer, back to per vertex like unused locations of a fresh VAO
+        for (GLuint index = first + (GLuint)instances.m_types.size(); index < first + m_instanceAttributes; ++index) {
+            glVertexAttribDivisor(index, 0);
+            glDisableVertexAttribArray(index);
+        }
 
-        enableVertexAttribPointers();
+        m_instanceAttributes = (GLuint)instances.m_types.size();
+        m_instances = instances.m_serial;
     }
 
-    void vertexUpdated(size_t index) {
-        if (m_minUpdatedIndex > (int)index)
-            m_minUpdatedIndex = (int)index;
-        if (m_maxUpdatedIndex < (int)index)
-            m_maxUpdatedIndex = (int)index;
+    void vertexUpdated(size_t index, size_t count = 1) {
+        if (count == 0)
+            return;
+
+        size_t first = index * m_vertexSize / c_pageSize;
+        size_t last = ((index + count) * m_vertexSize - 1) / c_pageSize;
+        for (size_t page = first; page <= last; ++page)
+            m_dirtyPages[page / 64] |= 1ull << (page % 64);
         m_changed = true;
     }
 
 private:
-    void enableVertexAttribPointers() const {
+    // Instance streams set their divisor on every location, 0 included, since the VAO may still hold another buffer's
+    void enableVertexAttribPointers(GLuint index, bool instanced) const {
         std::size_t sizeSoFar = 0;
-        GLuint index = 0;
         for (const auto& type : m_types) {
             // Enable attrib pointer
             glVertexAttribPointer(index, type.count, type.type, GL_FALSE, m_vertexSize, (void*)sizeSoFar);
             glEnableVertexAttribArray(index);
+            if (instanced)
+                glVertexAttribDivisor(index, m_divisor);
 
             // Move pointer
             sizeSoFar += type.size;
@@ -102,27 +168,35 @@ private:
         }
     }
 
+    // Upload runs of dirty pages, runs separated by a few clean pages go up as one
     void update() {
         if (!m_changed)
             return;
 
-        int updateBeg = m_minUpdatedIndex * m_vertexSize;
-        int updateSize = (m_maxUpdatedIndex - m_minUpdatedIndex + 1) * m_vertexSize;
-        if (updateSize < 1) {
-            m_changed = false;
-            return;
+        size_t runBegin = SIZE_MAX, runEnd = 0;
+        auto upload = [&] {
+            size_t begin = runBegin * c_pageSize;
+            size_t end = std::min(runEnd * c_pageSize, m_data.size());
+            glBufferSubData(GL_ARRAY_BUFFER, begin, end - begin, m_data.data() + begin);
+        };
+
+        for (size_t word = 0; word < m_dirtyPages.size(); ++word) {
+            for (uint64_t bits = m_dirtyPages[word]; bits; bits &= bits - 1) {
+                size_t page = word * 64 + std::countr_zero(bits);
+                if (runBegin != SIZE_MAX && page - runEnd > c_mergePages) {
+                    upload();
+                    runBegin = SIZE_MAX;
+                }
+                if (runBegin == SIZE_MAX)
+                    runBegin = page;
+                runEnd = page + 1;
+            }
         }
+        if (runBegin != SIZE_MAX)
+            upload();
 
-        void* dataBeg = &(m_data.data())[m_minUpdatedIndex * m_vertexSize];
-
-        // Update vertices inide range
-        glBindVertexArray(m_glVertexBuffer.vao);
-        glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer.id);
-        glBufferSubData(GL_ARRAY_BUFFER, updateBeg, updateSize, dataBeg);
-
+        std::fill(m_dirtyPages.begin(), m_dirtyPages.end(), 0);
         m_changed = false;
-        m_minUpdatedIndex = std::numeric_limits<int>::infinity();
-        m_maxUpdatedIndex = -1;
     }
 };
 
@@ -146,11 +220,226 @@ void VertexBufferBase::draw(Primitive primitive, Shader& shader) const {
 
 VertexBufferBase::~VertexBufferBase() { }
 
+uintptr_t VertexBufferBase::at_impl(size_t index)
+{
+    uintptr_t vertex = std::as_const(*this).at_impl(index);
+    m_impl->vertexUpdated(index);
+    return vertex;
+}
+
 uintptr_t VertexBufferBase::at_impl(size_t index) const
 {
     return reinterpret_cast<uintptr_t>(&m_impl->m_data.at(index * m_impl->m_vertexSize));
 }
 
+void VertexBufferBase::write(size_t index, const void* vertices, size_t count)
+{
+    if (index > m_impl->m_count || count > m_impl->m_count - index)
+        throw std::out_of_range("Vertex buffer write out of range");
+
+    std::memcpy(m_impl->m_data.data() + index * m_impl->m_vertexSize, vertices, count * m_impl->m_vertexSize);
+    m_impl->vertexUpdated(index, count);
+}
+
+struct IndexBufferBase::Impl {
+    GLuint   m_id = 0;
+    size_t   m_count;
+    GLType   m_type;
+    // Vertex buffers recognize their attached index buffer by this
+    uint64_t m_serial = nextSerial();
+
+    Impl(size_t count, GLType type, const void* data)
+        : m_count(count)
+        , m_type(type)
+    {
+        // Uploaded through the copy target, binding an element array buffer here would attach it to the caller's VAO
+        glGenBuffers(1, &m_id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_id);
+        glBufferData(GL_COPY_WRITE_BUFFER, count * type.size, data, GL_STATIC_DRAW);
+    }
+
+    ~Impl() { glDeleteBuffers(1, &m_id); }
+};
+
+IndexBufferBase::IndexBufferBase(size_t count, GLType type, const void* data)
+    : m_impl(std::make_unique<Impl>(count, type, data))
+{ }
+
+IndexBufferBase::~IndexBufferBase() { }
+
+size_t IndexBufferBase::count() const {
+    return m_impl->m_count;
+}
+
+void VertexBufferBase::drawIndexed(Primitive primitive, const IndexBufferBase& indices) const {
+    bind();
+    m_impl->bindIndices(indices.m_impl->m_id, indices.m_impl->m_serial);
+    glDrawElements((GLenum)primitive, (GLsizei)indices.m_impl->m_count, indices.m_impl->m_type.type, nullptr);
+}
+
+void VertexBufferBase::drawIndexed(Primitive primitive, const IndexBufferBase& indices, Shader& shader) const {
+    shader.use();
+    drawIndexed(primitive, indices);
+}
+
+void VertexBufferBase::drawInstanced(Primitive primitive, const VertexBufferBase& instances, size_t instanceCount) const {
+    instances.m_impl->flush();
+    bind();
+    m_impl->attachInstances(*instances.m_impl);
+    glDrawArraysInstanced((GLenum)primitive, 0, (GLsizei)m_impl->m_count, (GLsizei)instanceCount);
+}
+
+void VertexBufferBase::drawInstanced(Primitive primitive, const VertexBufferBase& instances, size_t instanceCount, Shader& shader) const {
+    shader.use();
+    drawInstanced(primitive, instances, instanceCount);
+}
+
+void VertexBufferBase::drawIndexedInstanced(Primitive primitive, const IndexBufferBase& indices, const VertexBufferBase& instances, size_t instanceCount) const {
+    instances.m_impl->flush();
+    bind();
+    m_impl->bindIndices(indices.m_impl->m_id, indices.m_impl->m_serial);
+    m_impl->attachInstances(*instances.m_impl);
+    glDrawElementsInstanced((GLenum)primitive, (GLsizei)indices.m_impl->m_count, indices.m_impl->m_type.type, nullptr, (GLsizei)instanceCount);
+}
+
+void VertexBufferBase::drawIndexedInstanced(Primitive primitive, const IndexBufferBase& indices, const VertexBufferBase& instances, size_t instanceCount, Shader& shader) const {
+    shader.use();
+    drawIndexedInstanced(primitive, indices, instances, instanceCount);
+}
+
+void VertexBufferBase::setDivisor(unsigned divisor) {
+    m_impl->m_divisor = divisor;
+}
+
+size_t NS_DEVKIT::weldVertices(std::byte* vertices, size_t count, size_t vertexSize, uint32_t* indices, size_t maxIndex) {
+    // Number the distinct vertices first, so a mesh over the index limit throws before vertices are moved
+    std::unordered_map<std::string_view, uint32_t> unique;
+    unique.reserve(count);
+    std::vector<size_t> firstUse;
+
+    for (size_t i = 0; i < count; ++i) {
+        std::string_view vertex(reinterpret_cast<const char*>(vertices + i * vertexSize), vertexSize);
+        auto [it, inserted] = unique.try_emplace(vertex, (uint32_t)firstUse.size());
+        if (inserted) {
+            if (firstUse.size() > maxIndex)
+                throw std::length_error("Welded mesh has more vertices than its index type can address");
+            firstUse.push_back(i);
+        }
+        indices[i] = it->second;
+    }
+
+    // First uses are ascending and never before their target, so sources aren't overwritten before they are read
+    for (size_t u = 0; u < firstUse.size(); ++u)
+        if (firstUse[u] != u)
+            std::memcpy(vertices + u * vertexSize, vertices + firstUse[u] * vertexSize, vertexSize);
+    return firstUse.size();
+}
+
+namespace {
+
+// Tipsify (Sander, Nehab, Barczak 2007): fans around the most recently used vertex that will stay in a cache of c_cacheSize
+void reorderTriangles(uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    constexpr int64_t c_cacheSize = 16;
+    size_t triangleCount = indexCount / 3;
+
+    // Triangles around each vertex
+    std::vector<uint32_t> offsets(vertexCount + 1), adjacency(triangleCount * 3);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        ++offsets[indices[i] + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+    std::vector<uint32_t> live(vertexCount), result;
+    for (size_t v = 0; v < vertexCount; ++v)
+        live[v] = offsets[v + 1] - offsets[v];
+    std::vector<int64_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd, candidates;
+    result.reserve(triangleCount * 3);
+
+    int64_t time = c_cacheSize + 1;
+    size_t cursor = 0;
+    auto skipDeadEnd = [&]() -> int64_t {
+        while (!deadEnd.empty()) {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0)
+                return v;
+        }
+        for (; cursor < vertexCount; ++cursor)
+            if (live[cursor] > 0)
+                return (int64_t)cursor;
+        return -1;
+    };
+
+    for (int64_t fan = skipDeadEnd(); fan >= 0;) {
+        candidates.clear();
+        for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a) {
+            uint32_t triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+            for (size_t corner = 0; corner < 3; ++corner) {
+                uint32_t v = indices[triangle * 3 + corner];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cacheTime[v] > c_cacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+
+        // Prefer the oldest candidate that stays cached while its remaining triangles are emitted
+        int64_t next = -1, best = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0)
+                continue;
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * (int64_t)live[v] <= c_cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        fan = next >= 0 ? next : skipDeadEnd();
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+}
+
+void NS_DEVKIT::optimizeMesh(std::byte* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indices, size_t indexCount) {
+    if (indexCount % 3 != 0)
+        throw std::invalid_argument("Mesh optimization expects a triangle list");
+    if (std::any_of(indices, indices + indexCount, [&](uint32_t index) { return index >= vertexCount; }))
+        throw std::out_of_range("Mesh index out of range");
+    reorderTriangles(indices, indexCount, vertexCount);
+
+    // Renumber vertices in order of first use, unreferenced ones go last
+    constexpr uint32_t c_unassigned = UINT32_MAX;
+    std::vector<uint32_t> remap(vertexCount, c_unassigned);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        if (remap[indices[i]] == c_unassigned)
+            remap[indices[i]] = next++;
+        indices[i] = remap[indices[i]];
+    }
+    for (auto& index : remap)
+        if (index == c_unassigned)
+            index = next++;
+
+    std::vector<std::byte> reordered(vertexCount * vertexSize);
+    for (size_t v = 0; v < vertexCount; ++v)
+        std::memcpy(reordered.data() + remap[v] * vertexSize, vertices + v * vertexSize, vertexSize);
+    std::memcpy(vertices, reordered.data(), reordered.size());
+}
+
 
 void writeShaderCompilationErrorInfo(unsigned int handle) {
     int logLen, written;
@@ -179,28 +468,32 @@ bool checkShaderCompilation(unsigned id, const char* source) {
 }
 
 ShaderSource::ShaderSource(std::string&& source)
-    : m_source(source)
+    : m_source(std::move(source))
     , m_updated(true)
 { }
 
 ShaderSource ShaderSource::loadFromFile(const wchar_t* path)
 {
-    std::ifstream ifs(path);
-    std::ostringstream contents;
-    contents << ifs.rdbuf();
-    ifs.close();
-    
-    return ShaderSource(std::move(contents.str()));
+    // Missing files give an empty source
+    auto file = AssetManager::FileView::map(path);
+    return file ? loadFromView(*file) : ShaderSource("");
+}
+
+ShaderSource ShaderSource::loadFromView(const AssetManager::FileView& file)
+{
+    return ShaderSource(std::string(file.string()));
 }
 
 void ShaderSource::updateFromFile(const wchar_t* path)
 {
-    std::ifstream ifs(path);
-    std::ostringstream contents;
-    contents << ifs.rdbuf();
-    ifs.close();
+    auto file = AssetManager::FileView::map(path);
+    m_source = file ? file->string() : "";
+    m_updated = true;
+}
 
-    m_source = contents.str();
+void ShaderSource::updateFromView(const AssetManager::FileView& file)
+{
+    m_source = file.string();
     m_updated = true;
 }
 
@@ -717,11 +1010,46 @@ Texture Texture::load(const wchar_t* path)
     return Texture(pixels, { width, height });
 }
 
+Texture Texture::loadFromView(const AssetManager::FileView& file)
+{
+    return upload(decode(file));
+}
+
 void Texture::update(const wchar_t* path) 
 {
     *this = load(path);
 }
 
+void Texture::updateFromView(const AssetManager::FileView& file)
+{
+    *this = loadFromView(file);
+}
+
+Texture::Image Texture::decode(const AssetManager::FileView& file)
+{
+    // Flip setting of this thread only, decodes run on loader threads
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(true);
+    auto data = file.data();
+    unsigned char* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(data.data()), (int)data.size(),
+                                                  &width, &height, &channels, 4);
+    if (!pixels)
+        throw std::runtime_error("Failed to decode texture");
+    DBG("Decoded texture from {}", utf8(file.path()));
+    return { std::shared_ptr<unsigned char>(pixels, stbi_image_free), { width, height } };
+}
+
+Texture Texture::upload(Image&& image)
+{
+    // Pixels are copied on upload
+    return Texture(image.pixels.get(), image.size);
+}
+
+void Texture::reupload(Image&& image)
+{
+    *this = upload(std::move(image));
+}
+
 Texture::~Texture() { }
 
 
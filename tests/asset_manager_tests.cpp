@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ASSET_MANAGER_FILE_SYSTEM is mockfs for the whole target, see CMakeLists.txt
+#include "mock_filesystem.h"
+#include "devkit/util.h"
+#include "devkit/asset_manager.h"
+
+// AssetManager checks on an in-memory file system. Returns non-zero if any check fails.
+
+using namespace NS_DEVKIT;
+
+namespace {
+
+struct Texture  { uint32_t id; };
+struct Material { std::string source; };
+
+std::string readLine(const wchar_t* path) {
+	mockfs::ifstream in(path);
+	std::string line;
+	std::getline(in, line);
+	return line;
+}
+
+int g_failures = 0;
+
+void check(bool condition, const char* test, const std::string& message) {
+	if (condition)
+		return;
+	std::printf("%s: %s\n", test, message.c_str());
+	++g_failures;
+}
+
+// A dependency edited after its dependent reloaded, but before the next synchronize, reloads the dependent again
+void dependencyEditedTwice(const char* test, const wchar_t* dependency) {
+	mockfs::clear();
+	mockfs::write(L"assets/base.tex", "A");
+	mockfs::write(L"external/base.txt", "A");
+	mockfs::write(L"assets/surface.mat", "");
+
+	AssetManager am;
+	auto& dir = am.directory(L"assets",
+		am.ext(L".tex", [](const wchar_t*) { return Texture{ 1 }; }),
+		am.ext(L".mat", [dependency](const wchar_t*) {
+			AssetManager::dependsOn(dependency);
+			return Material{ readLine(dependency) };
+		}));
+	dir.synchronize();
+
+	for (const char* source : { "B", "C", "D" }) {
+		mockfs::write(dependency, source);
+		dir.synchronize();
+		std::string loaded = dir.get<Material>(L"assets/surface.mat").source;
+		check(loaded == source, test, "expected " + std::string(source) + ", loaded " + loaded);
+	}
+}
+
+}
+
+int main() {
+	dependencyEditedTwice("dependency_asset_edited_twice", L"assets/base.tex");
+	dependencyEditedTwice("dependency_file_edited_twice", L"external/base.txt");
+
+	if (g_failures == 0)
+		std::printf("All checks passed\n");
+	return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "devkit/devkit.h"
+
+// Packs a directory tree into a single file AssetManager::Directory::mount can serve assets from:
+// devkit_pack <directory> <output> [--lz4]
+
+using namespace NS_DEVKIT;
+
+int main(int argc, char** argv) {
+	if (argc < 3 || argc > 4 || (argc == 4 && std::strcmp(argv[3], "--lz4") != 0)) {
+		std::cerr << "Usage: devkit_pack <directory> <output> [--lz4]" << std::endl;
+		return 1;
+	}
+
+	std::wstring directory = std::filesystem::path(argv[1]).wstring();
+	std::wstring output = std::filesystem::path(argv[2]).wstring();
+	if (!std::filesystem::is_directory(directory)) {
+		std::cerr << argv[1] << " is not a directory" << std::endl;
+		return 1;
+	}
+
+	return AssetManager::Pack::write(directory.c_str(), output.c_str(), argc == 4) ? 0 : 1;
+}